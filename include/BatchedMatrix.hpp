@@ -0,0 +1,291 @@
+#ifndef BATCHED_MATRIX_HPP
+#define BATCHED_MATRIX_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "Matrix.hpp"
+#include "Parallel.hpp"
+#include "PerfCounters.hpp"
+#include "SparseKernels.hpp"
+#include "Utils.hpp"
+
+namespace algebra {
+
+/**
+ * @brief Batch of compressed row matrices sharing one sparsity pattern.
+ *
+ * The row pointers and column indices are stored once. The values are
+ * interleaved by slabs of L matrices: in a slab, entry k of the L matrices
+ * is contiguous (the last slab is padded with zero matrices), so the product
+ * reads the pattern once per slab and runs every entry on L matrices at once,
+ * one per SIMD lane. Vectors of the batch use the same layout, see
+ * interleave / deinterleave.
+ *
+ * The product and the norms handle the whole batch in one pass, the slabs
+ * (and the rows of a slab, when there are fewer slabs than threads) split
+ * over the threads.
+ *
+ * @tparam T Type of the entries.
+ * @tparam L Matrices per slab.
+ * @tparam Index Type of the indices.
+ */
+template <Numeric T, std::size_t L = 8, IndexType Index = std::size_t>
+class BatchedMatrix {
+    static_assert(L > 0, "The slab width must be positive");
+
+public:
+    BatchedMatrix() = default;
+
+    // batch_size copies of a Matrix in any StorageOrder, compressed or not;
+    // its entries give the pattern
+    template <StorageOrder order>
+    BatchedMatrix(const Matrix<T, order, Index>& m, std::size_t batch_size) {
+        const Matrix<T, ROW_MAJOR, Index> m_rows = to_rows(m);
+        build_pattern(m_rows, batch_size);
+        for (std::size_t b = 0; b < batch_size; ++b)
+            set_instance_values(b, std::span<const T>(m_rows.get_values()));
+    }
+
+    // one matrix per instance, all with the same pattern (std::invalid_argument otherwise)
+    template <StorageOrder order>
+    explicit BatchedMatrix(const std::vector<Matrix<T, order, Index>>& instances) {
+        if (instances.empty())
+            return;
+        build_pattern(to_rows(instances.front()), instances.size());
+        for (std::size_t b = 0; b < instances.size(); ++b)
+            set_instance_values(b, instances[b]);
+    }
+
+    std::size_t get_rows() const { return rows; }
+    std::size_t get_cols() const { return cols; }
+    // entries of every matrix
+    std::size_t get_num_non_zero() const { return col_indices.size(); }
+    std::size_t get_batch_size() const { return batch_size; }
+    std::size_t get_num_slabs() const { return (batch_size + L - 1) / L; }
+
+    const std::vector<Index>& get_row_indices() const { return row_indices; }
+    const std::vector<Index>& get_col_indices() const { return col_indices; }
+    // all the values, interleaved
+    const std::vector<T>& get_values() const { return values; }
+
+    // values of matrix b in the order of the pattern, i.e. of the compressed
+    // ROW_MAJOR arrays (CSR order), whatever the order of the source matrices
+    std::vector<T> get_instance_values(std::size_t b) const {
+        check_instance(b);
+        const std::size_t nnz = get_num_non_zero();
+        std::vector<T> out(nnz);
+        const T* slab = values.data() + b / L * nnz * L;
+        for (std::size_t k = 0; k < nnz; ++k)
+            out[k] = slab[k * L + b % L];
+        return out;
+    }
+
+    // new values of matrix b, in CSR order as get_instance_values
+    void set_instance_values(std::size_t b, std::span<const T> instance_values) {
+        check_instance(b);
+        const std::size_t nnz = get_num_non_zero();
+        if (instance_values.size() != nnz)
+            throw std::invalid_argument("The values do not match the pattern of the batch");
+        T* slab = values.data() + b / L * nnz * L;
+        for (std::size_t k = 0; k < nnz; ++k)
+            slab[k * L + b % L] = instance_values[k];
+    }
+
+    // the values of a Matrix in any StorageOrder with the pattern of the
+    // batch (std::invalid_argument otherwise)
+    template <StorageOrder order>
+    void set_instance_values(std::size_t b, const Matrix<T, order, Index>& m) {
+        const Matrix<T, ROW_MAJOR, Index> m_rows = to_rows(m);
+        if (m_rows.get_rows() != rows || m_rows.get_cols() != cols || m_rows.get_row_indices() != row_indices ||
+            m_rows.get_col_indices() != col_indices)
+            throw std::invalid_argument("The matrices of a batch must share their pattern");
+        set_instance_values(b, m_rows.get_values());
+    }
+
+    // matrix b as a compressed Matrix in the given StorageOrder
+    template <StorageOrder order = ROW_MAJOR>
+    Matrix<T, order, Index> get_instance(std::size_t b) const {
+        Matrix<T, ROW_MAJOR, Index> m(get_instance_values(b), row_indices, col_indices, rows, cols);
+        if constexpr (order == ROW_MAJOR)
+            return m;
+        else
+            return m.template convert<COL_MAJOR>();
+    }
+
+    void set_num_threads(std::size_t n) { num_threads = n == 0 ? parallel::hardware_threads() : n; }
+    std::size_t get_num_threads() const { return num_threads; }
+
+    // entry (row, col) of matrix b, binary search of the column in the row
+    T operator()(std::size_t b, std::size_t row, std::size_t col) const {
+        check_instance(b);
+        if (row >= rows || col >= cols)
+            throw std::out_of_range("Index out of range");
+        const std::size_t pos = kernels::find_in_line<Index>(col_indices, row_indices[row], row_indices[row + 1], col);
+        return pos == row_indices[row + 1] ? T(0) : values[b / L * get_num_non_zero() * L + pos * L + b % L];
+    }
+
+    // batch_size vectors of the same length n in the interleaved layout
+    // (get_num_slabs() * n * L entries, the padding lanes zero)
+    std::vector<T> interleave(const std::vector<std::vector<T>>& vectors) const {
+        if (vectors.size() != batch_size)
+            throw std::invalid_argument("One vector per matrix of the batch is needed");
+        const std::size_t n = vectors.empty() ? 0 : vectors.front().size();
+        std::vector<T> out(get_num_slabs() * n * L, T(0));
+        for (std::size_t b = 0; b < batch_size; ++b) {
+            if (vectors[b].size() != n)
+                throw std::invalid_argument("The vectors of a batch must have the same length");
+            T* slab = out.data() + b / L * n * L;
+            for (std::size_t j = 0; j < n; ++j)
+                slab[j * L + b % L] = vectors[b][j];
+        }
+        return out;
+    }
+
+    std::vector<std::vector<T>> deinterleave(std::span<const T> interleaved, std::size_t n) const {
+        if (interleaved.size() < get_num_slabs() * n * L)
+            throw std::invalid_argument("Interleaved vector too short for the batch");
+        std::vector<std::vector<T>> out(batch_size, std::vector<T>(n));
+        for (std::size_t b = 0; b < batch_size; ++b) {
+            const T* slab = interleaved.data() + b / L * n * L;
+            for (std::size_t j = 0; j < n; ++j)
+                out[b][j] = slab[j * L + b % L];
+        }
+        return out;
+    }
+
+    // y_b = alpha * A_b x_b + beta * y_b for every matrix, x and y interleaved
+    void multiply(std::span<const T> x, std::span<T> y, T alpha = T(1), T beta = T(0)) const;
+
+    // one norm per matrix
+    template <WhichNorm NORM>
+    std::vector<T> norm() const;
+
+    friend std::vector<std::vector<T>> operator*(const BatchedMatrix& m, const std::vector<std::vector<T>>& v) {
+        for (const auto& v_b : v)
+            if (v_b.size() != m.cols)
+                throw std::invalid_argument("Matrix and vector dimensions do not match for multiplication");
+        const std::vector<T> x = m.interleave(v);
+        std::vector<T> y(m.get_num_slabs() * m.rows * L);
+        m.multiply(x, y);
+        return m.deinterleave(y, m.rows);
+    }
+
+private:
+    template <StorageOrder order>
+    static Matrix<T, ROW_MAJOR, Index> to_rows(const Matrix<T, order, Index>& m) {
+        if constexpr (order == ROW_MAJOR) {
+            Matrix<T, ROW_MAJOR, Index> m_rows = m;
+            m_rows.compress();
+            return m_rows;
+        } else {
+            Matrix<T, COL_MAJOR, Index> m_compressed = m;
+            m_compressed.compress();
+            return m_compressed.template convert<ROW_MAJOR>();
+        }
+    }
+
+    void build_pattern(const Matrix<T, ROW_MAJOR, Index>& m, std::size_t size) {
+        rows = m.get_rows();
+        cols = m.get_cols();
+        num_threads = m.get_num_threads();
+        batch_size = size;
+        row_indices = m.get_row_indices();
+        col_indices = m.get_col_indices();
+        values.assign(get_num_slabs() * col_indices.size() * L, T(0));
+    }
+
+    void check_instance(std::size_t b) const {
+        if (b >= batch_size)
+            throw std::out_of_range("Index out of range");
+    }
+
+    // f(slab, row_begin, row_end) over the slabs split between the threads;
+    // with fewer slabs than threads the rows of every slab are split too
+    template <typename F>
+    void for_each_slab_part(F&& f) const {
+        const std::size_t num_slabs = get_num_slabs();
+        if (num_slabs == 0)
+            return;
+        const std::size_t row_parts = std::max<std::size_t>(1, num_threads / num_slabs);
+        const auto row_bounds = kernels::balanced_partition<Index>(row_indices, row_parts);
+        const std::size_t tasks = num_slabs * row_parts, workers = std::min(num_threads, tasks);
+        parallel::run(workers, [&](std::size_t t) {
+            for (std::size_t task = tasks * t / workers; task < tasks * (t + 1) / workers; ++task)
+                f(task / row_parts, row_bounds[task % row_parts], row_bounds[task % row_parts + 1]);
+        });
+    }
+
+    std::size_t rows = 0, cols = 0;
+    std::size_t batch_size = 0;
+    std::size_t num_threads = 1;
+    std::vector<Index> row_indices;  // rows + 1 entries
+    std::vector<Index> col_indices;
+    std::vector<T> values;           // get_num_slabs() * nnz * L
+};
+
+template <Numeric T, std::size_t L, IndexType Index>
+void BatchedMatrix<T, L, Index>::multiply(std::span<const T> x, std::span<T> y, T alpha, T beta) const {
+    const std::size_t num_slabs = get_num_slabs(), nnz = get_num_non_zero();
+    if (x.size() < num_slabs * cols * L || y.size() < num_slabs * rows * L)
+        throw std::invalid_argument("Vector sizes do not match the matrix dimensions");
+    ALGEBRA_PERF_REGION("spmv_batched");
+    for_each_slab_part([&](std::size_t s, std::size_t begin, std::size_t end) {
+        kernels::batched_spmv_gather<T, Index, L>(row_indices, col_indices,
+                                                  std::span<const T>(values).subspan(s * nnz * L, nnz * L),
+                                                  x.subspan(s * cols * L, cols * L), y.subspan(s * rows * L, rows * L),
+                                                  alpha, beta, begin, end);
+    });
+}
+
+// every slab in one pass over its values, the L matrices in the inner loops;
+// the slabs are split between the threads
+template <Numeric T, std::size_t L, IndexType Index>
+template <WhichNorm NORM>
+std::vector<T> BatchedMatrix<T, L, Index>::norm() const {
+    using Real = real_type_t<T>;
+    const std::size_t num_slabs = get_num_slabs(), nnz = get_num_non_zero();
+    std::vector<Real> result(num_slabs * L, Real(0));
+    const std::size_t workers = std::max<std::size_t>(1, std::min(num_threads, num_slabs));
+    parallel::run(workers, [&](std::size_t t) {
+        std::vector<Real> sum_col(NORM == WhichNorm::ONE ? cols * L : 0);
+        for (std::size_t s = num_slabs * t / workers; s < num_slabs * (t + 1) / workers; ++s) {
+            const T* slab = values.data() + s * nnz * L;
+            Real* out = result.data() + s * L;
+            if constexpr (NORM == WhichNorm::FROBENIUS) {
+                std::array<Real, L> acc{};
+                for (std::size_t k = 0; k < nnz; ++k)
+                    for (std::size_t l = 0; l < L; ++l)
+                        acc[l] += static_cast<Real>(std::norm(slab[k * L + l]));
+                for (std::size_t l = 0; l < L; ++l)
+                    out[l] = std::sqrt(acc[l]);
+            } else if constexpr (NORM == WhichNorm::ONE) {
+                std::fill(sum_col.begin(), sum_col.end(), Real(0));
+                for (std::size_t k = 0; k < nnz; ++k)
+                    for (std::size_t l = 0; l < L; ++l)
+                        sum_col[col_indices[k] * L + l] += static_cast<Real>(std::abs(slab[k * L + l]));
+                for (std::size_t j = 0; j < cols; ++j)
+                    for (std::size_t l = 0; l < L; ++l)
+                        out[l] = std::max(out[l], sum_col[j * L + l]);
+            } else {
+                for (std::size_t i = 0; i < rows; ++i) {
+                    std::array<Real, L> acc{};
+                    for (std::size_t k = row_indices[i]; k < row_indices[i + 1]; ++k)
+                        for (std::size_t l = 0; l < L; ++l)
+                            acc[l] += static_cast<Real>(std::abs(slab[k * L + l]));
+                    for (std::size_t l = 0; l < L; ++l)
+                        out[l] = std::max(out[l], acc[l]);
+                }
+            }
+        }
+    });
+    return std::vector<T>(result.begin(), result.begin() + batch_size);
+}
+
+}  // namespace algebra
+
+#endif
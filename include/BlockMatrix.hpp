@@ -0,0 +1,199 @@
+#ifndef BLOCK_MATRIX_HPP
+#define BLOCK_MATRIX_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "Matrix.hpp"
+#include "Parallel.hpp"
+#include "SparseKernels.hpp"
+#include "Utils.hpp"
+
+namespace algebra {
+
+/**
+ * @brief Block compressed sparse row (BSR) matrix with B x B dense blocks.
+ *
+ * Matrices of multi-component problems have small dense blocks: storing one
+ * block column index per B x B block instead of one column index per scalar
+ * divides the index traffic by B^2, and with B known at compile time the SpMV
+ * and norm kernels are unrolled over the block.
+ *
+ * A block is stored as soon as one of its entries is nonzero, the missing
+ * entries are explicit zeros. When rows or cols are not multiples of B the
+ * last block row / column is padded with zeros.
+ *
+ * @tparam T Type of the entries.
+ * @tparam B Size of the blocks.
+ * @tparam Index Type of the block indices.
+ */
+template <Numeric T, std::size_t B, IndexType Index = std::size_t>
+class BlockMatrix {
+    static_assert(B > 0, "The block size must be positive");
+
+public:
+    BlockMatrix() = default;
+
+    // build from a Matrix in any StorageOrder, compressed or not (a map or
+    // COL_MAJOR matrix goes through a compressed ROW_MAJOR copy)
+    template <StorageOrder order>
+    explicit BlockMatrix(const Matrix<T, order, Index>& m) {
+        if constexpr (order == ROW_MAJOR) {
+            if (m.is_fully_compressed()) {
+                build(m);
+            } else {
+                Matrix<T, ROW_MAJOR, Index> m_compressed = m;
+                m_compressed.compress();
+                build(m_compressed);
+            }
+        } else {
+            Matrix<T, COL_MAJOR, Index> m_compressed = m;
+            m_compressed.compress();
+            build(m_compressed.template convert<ROW_MAJOR>());
+        }
+    }
+
+    std::size_t get_rows() const { return rows; }
+    std::size_t get_cols() const { return cols; }
+    std::size_t get_block_rows() const { return block_rows; }
+    std::size_t get_block_cols() const { return block_cols; }
+    std::size_t get_num_blocks() const { return block_indices.size(); }
+    // stored entries, explicit zeros of the blocks included
+    std::size_t get_num_stored() const { return values.size(); }
+
+    const std::vector<T>& get_values() const { return values; }
+    const std::vector<Index>& get_block_ptr() const { return block_ptr; }
+    const std::vector<Index>& get_block_indices() const { return block_indices; }
+
+    void set_num_threads(std::size_t n) { num_threads = n == 0 ? parallel::hardware_threads() : n; }
+    std::size_t get_num_threads() const { return num_threads; }
+
+    // element access, binary search of the block column in the block row
+    T operator()(std::size_t row, std::size_t col) const {
+        if (row >= rows || col >= cols)
+            throw std::out_of_range("Index out of range");
+        const std::size_t I = row / B, J = col / B;
+        const auto first = block_indices.begin() + block_ptr[I], last = block_indices.begin() + block_ptr[I + 1];
+        const auto it = std::lower_bound(first, last, static_cast<Index>(J));
+        if (it == last || *it != J)
+            return T(0);
+        const std::size_t k = it - block_indices.begin();
+        return values[k * B * B + (row % B) * B + col % B];
+    }
+
+    template <WhichNorm NORM>
+    T norm() const;
+
+    friend std::vector<T> operator*(const BlockMatrix& m, const std::vector<T>& v) {
+        if (v.size() != m.cols)
+            throw std::invalid_argument("Matrix and vector dimensions do not match for multiplication");
+        // the kernels read and write whole blocks: pad x and y when the
+        // dimensions are not multiples of B
+        std::vector<T> x_padded;
+        std::span<const T> x(v);
+        if (m.cols % B != 0) {
+            x_padded.assign(m.block_cols * B, T(0));
+            std::copy(v.begin(), v.end(), x_padded.begin());
+            x = x_padded;
+        }
+        std::vector<T> out(m.block_rows * B, T(0));
+        const auto bounds = kernels::balanced_partition<Index>(m.block_ptr, m.num_threads);
+        parallel::run(m.num_threads, [&](std::size_t t) {
+            kernels::bsr_spmv_gather<T, Index, B>(m.block_ptr, m.block_indices, m.values, x, out, bounds[t], bounds[t + 1]);
+        });
+        out.resize(m.rows);
+        return out;
+    }
+
+private:
+    void build(const Matrix<T, ROW_MAJOR, Index>& m);
+
+    std::size_t rows = 0, cols = 0;
+    std::size_t block_rows = 0, block_cols = 0;
+    std::size_t num_threads = 1;
+    std::vector<Index> block_ptr;      // block_rows + 1 entries
+    std::vector<Index> block_indices;  // block column of every block, sorted in each block row
+    std::vector<T> values;             // B * B entries per block, row-major inside the block
+};
+
+// one pass over the CSR arrays per block row: a marker array over the block
+// columns finds the blocks of the B scalar rows, which are then sorted and filled
+template <Numeric T, std::size_t B, IndexType Index>
+void BlockMatrix<T, B, Index>::build(const Matrix<T, ROW_MAJOR, Index>& m) {
+    rows = m.get_rows();
+    cols = m.get_cols();
+    block_rows = (rows + B - 1) / B;
+    block_cols = (cols + B - 1) / B;
+    const auto& ptr = m.get_row_indices();
+    const auto& idx = m.get_col_indices();
+    const auto& val = m.get_values();
+
+    constexpr std::size_t unmarked = static_cast<std::size_t>(-1);
+    std::vector<std::size_t> slot(block_cols, unmarked);  // position of the block in the current block row
+    block_ptr.assign(block_rows + 1, 0);
+    block_indices.clear();
+    values.clear();
+
+    std::vector<Index> line;
+    for (std::size_t I = 0; I < block_rows; ++I) {
+        const std::size_t row_begin = I * B, row_end = std::min(rows, row_begin + B);
+        line.clear();
+        for (std::size_t k = ptr[row_begin]; k < ptr[row_end]; ++k) {
+            const std::size_t J = idx[k] / B;
+            if (slot[J] == unmarked) {
+                slot[J] = 0;
+                line.push_back(static_cast<Index>(J));
+            }
+        }
+        std::sort(line.begin(), line.end());
+        const std::size_t first = block_indices.size();
+        for (std::size_t p = 0; p < line.size(); ++p)
+            slot[line[p]] = first + p;
+        block_indices.insert(block_indices.end(), line.begin(), line.end());
+        values.resize(block_indices.size() * B * B, T(0));
+
+        for (std::size_t i = row_begin; i < row_end; ++i)
+            for (std::size_t k = ptr[i]; k < ptr[i + 1]; ++k)
+                values[slot[idx[k] / B] * B * B + (i - row_begin) * B + idx[k] % B] = val[k];
+        for (const Index J : line)
+            slot[J] = unmarked;
+
+        if (block_indices.size() > std::numeric_limits<Index>::max())
+            throw std::overflow_error("Too many blocks for the chosen index type");
+        block_ptr[I + 1] = static_cast<Index>(block_indices.size());
+    }
+}
+
+// ONE sums the columns with a serial scatter, MAX the rows in parallel over
+// the block rows; the padding zeros do not change any of the norms
+template <Numeric T, std::size_t B, IndexType Index>
+template <WhichNorm NORM>
+T BlockMatrix<T, B, Index>::norm() const {
+    auto norm_less = [](const T& a, const T& b) { return std::norm(a) < std::norm(b); };
+    if constexpr (NORM == WhichNorm::FROBENIUS) {
+        return std::sqrt(std::accumulate(values.begin(), values.end(), 0.0,
+            [](double acc, const T& value) {
+                return acc + std::norm(value);
+            }));
+    } else if constexpr (NORM == WhichNorm::ONE) {
+        std::vector<T> sum_col(block_cols * B, T(0));
+        kernels::bsr_abs_sums<T, Index, B>(block_ptr, block_indices, values, {}, sum_col, 0, block_rows);
+        return sum_col.empty() ? T(0) : *std::max_element(sum_col.begin(), sum_col.end(), norm_less);
+    } else {
+        std::vector<T> sum_row(block_rows * B, T(0));
+        const auto bounds = kernels::balanced_partition<Index>(block_ptr, num_threads);
+        parallel::run(num_threads, [&](std::size_t t) {
+            kernels::bsr_abs_sums<T, Index, B>(block_ptr, block_indices, values, sum_row, {}, bounds[t], bounds[t + 1]);
+        });
+        return sum_row.empty() ? T(0) : *std::max_element(sum_row.begin(), sum_row.end(), norm_less);
+    }
+}
+
+}  // namespace algebra
+
+#endif
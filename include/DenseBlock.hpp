@@ -0,0 +1,67 @@
+#ifndef DENSE_BLOCK_HPP
+#define DENSE_BLOCK_HPP
+
+#include <stdexcept>
+#include <vector>
+
+#include "Utils.hpp"
+
+namespace algebra {
+
+/**
+ * @brief Dense rows x cols panel, e.g. a block of right-hand sides.
+ *
+ * layout decides how the entries are stored in the contiguous array:
+ * ROW_MAJOR keeps the cols entries of a row together, COL_MAJOR keeps every
+ * column (i.e. every vector of the block) contiguous.
+ */
+template <Numeric T, StorageOrder layout = StorageOrder::COL_MAJOR>
+class DenseBlock {
+public:
+    DenseBlock() = default;
+
+    DenseBlock(std::size_t rows, std::size_t cols) : rows(rows), cols(cols), entries(rows * cols, T()) {}
+
+    DenseBlock(std::size_t rows, std::size_t cols, std::vector<T> entries)
+        : rows(rows), cols(cols), entries(std::move(entries)) {
+        if (this->entries.size() != rows * cols)
+            throw std::invalid_argument("DenseBlock: the number of entries does not match the dimensions");
+    }
+
+    T& operator()(std::size_t i, std::size_t j) {
+        return entries[index(i, j)];
+    }
+
+    T operator()(std::size_t i, std::size_t j) const {
+        return entries[index(i, j)];
+    }
+
+    //! copy of column j (one vector of the block)
+    std::vector<T> column(std::size_t j) const {
+        std::vector<T> out(rows);
+        for (std::size_t i = 0; i < rows; ++i)
+            out[i] = (*this)(i, j);
+        return out;
+    }
+
+    std::size_t get_rows() const { return rows; }
+    std::size_t get_cols() const { return cols; }
+
+    std::vector<T>& data() { return entries; }
+    const std::vector<T>& data() const { return entries; }
+
+private:
+    std::size_t index(std::size_t i, std::size_t j) const {
+        if constexpr (layout == StorageOrder::ROW_MAJOR)
+            return i * cols + j;
+        else
+            return j * rows + i;
+    }
+
+    std::size_t rows = 0, cols = 0;
+    std::vector<T> entries;
+};
+
+}  // namespace algebra
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef LOW_PRECISION_HPP
+#define LOW_PRECISION_HPP
+
+#include <bit>
+#include <cstdint>
+
+namespace algebra {
+
+/**
+ * @brief 16-bit storage formats for the values of MixedMatrix.
+ *
+ * They are storage only: a value is converted to float before any arithmetic
+ * (implicitly, so float, double and std::complex<double> accept it) and is
+ * built from a float or double explicitly, rounding to nearest even. Both
+ * conversions are done in software, on the bits.
+ */
+
+//! bfloat16: the upper half of a float, 8 exponent bits and 7 mantissa bits
+struct bfloat16 {
+    std::uint16_t bits = 0;
+
+    bfloat16() = default;
+    explicit bfloat16(float f) : bits(from_float(f)) {}
+    explicit bfloat16(double d) : bfloat16(static_cast<float>(d)) {}
+
+    operator float() const { return std::bit_cast<float>(static_cast<std::uint32_t>(bits) << 16); }
+
+private:
+    static std::uint16_t from_float(float f) {
+        const std::uint32_t u = std::bit_cast<std::uint32_t>(f);
+        if ((u & 0x7fffffff) > 0x7f800000)
+            return static_cast<std::uint16_t>((u >> 16) | 0x40);  // NaN stays a (quiet) NaN
+        return static_cast<std::uint16_t>((u + 0x7fff + ((u >> 16) & 1)) >> 16);
+    }
+};
+
+//! IEEE 754 binary16: 5 exponent bits and 10 mantissa bits, largest value 65504
+struct float16 {
+    std::uint16_t bits = 0;
+
+    float16() = default;
+    explicit float16(float f) : bits(from_float(f)) {}
+    explicit float16(double d) : float16(static_cast<float>(d)) {}
+
+    operator float() const {
+        const std::uint32_t sign = static_cast<std::uint32_t>(bits & 0x8000) << 16;
+        const std::uint32_t exponent = (bits >> 10) & 0x1f, mantissa = bits & 0x3ff;
+        if (exponent == 0x1f)
+            return std::bit_cast<float>(sign | 0x7f800000 | (mantissa << 13));
+        if (exponent == 0) {
+            // zero or subnormal, mantissa * 2^-24
+            const float value = static_cast<float>(mantissa) * 0x1p-24f;
+            return sign ? -value : value;
+        }
+        return std::bit_cast<float>(sign | ((exponent + 112) << 23) | (mantissa << 13));
+    }
+
+private:
+    static std::uint16_t from_float(float f) {
+        const std::uint32_t u = std::bit_cast<std::uint32_t>(f);
+        const std::uint32_t sign = (u >> 16) & 0x8000, magnitude = u & 0x7fffffff;
+        if (magnitude > 0x7f800000)
+            return static_cast<std::uint16_t>(sign | 0x7e00);  // NaN
+        if (magnitude >= 0x47800000)
+            return static_cast<std::uint16_t>(sign | 0x7c00);  // 65536 and above: infinity
+        if (magnitude < 0x38800000) {
+            // below 2^-14: subnormal, a multiple of 2^-24 (ties to even below 2^-25 give 0)
+            if (magnitude < 0x33000000)
+                return static_cast<std::uint16_t>(sign);
+            const std::uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+            const std::uint32_t shift = 126 - (magnitude >> 23);
+            std::uint32_t h = mantissa >> shift;
+            const std::uint32_t rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+            if (rest > halfway || (rest == halfway && (h & 1)))
+                ++h;
+            return static_cast<std::uint16_t>(sign | h);
+        }
+        // rebias the exponent (127 -> 15) and round the mantissa to 10 bits;
+        // a carry out of the mantissa correctly moves to the next exponent
+        std::uint32_t h = (magnitude - 0x38000000) >> 13;
+        const std::uint32_t rest = magnitude & 0x1fff;
+        if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+            ++h;
+        return static_cast<std::uint16_t>(sign | h);
+    }
+};
+
+}  // namespace algebra
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace algebra {
+
+/**
+ * @brief Read-only memory mapping of a whole file (POSIX mmap).
+ *
+ * The mapping is released by the destructor. The object can be moved but not
+ * copied, so that the owner of the mapping is always well defined.
+ */
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    explicit MappedFile(const std::string& file_name) {
+        int fd = ::open(file_name.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open file: " + file_name);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Failed to stat file: " + file_name);
+        }
+        length = static_cast<std::size_t>(st.st_size);
+        if (length > 0) {
+            void* ptr = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ptr == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Failed to map file: " + file_name);
+            }
+            address = static_cast<const char*>(ptr);
+            // the file is read front to back by the parsers
+            ::madvise(ptr, length, MADV_SEQUENTIAL);
+        }
+        ::close(fd);  // the mapping stays valid after closing the descriptor
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept
+        : address(std::exchange(other.address, nullptr)), length(std::exchange(other.length, 0)) {}
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            address = std::exchange(other.address, nullptr);
+            length = std::exchange(other.length, 0);
+        }
+        return *this;
+    }
+
+    ~MappedFile() { unmap(); }
+
+    const char* data() const { return address; }
+    std::size_t size() const { return length; }
+    std::string_view view() const { return {address, length}; }
+
+private:
+    void unmap() {
+        if (address != nullptr) {
+            ::munmap(const_cast<char*>(address), length);
+            address = nullptr;
+            length = 0;
+        }
+    }
+
+    const char* address = nullptr;
+    std::size_t length = 0;
+};
+
+}  // namespace algebra
+
+#endif
@@ -7,22 +7,67 @@
 #include <cmath>
 #include <complex>
 #include <map>
+#include <unordered_map>
 #include "Utils.hpp"
+#include "SparseKernels.hpp"
+#include "Parallel.hpp"
+#include "DenseBlock.hpp"
+#include "PerfCounters.hpp"
+#include "PoolAllocator.hpp"
 #include <iomanip>
+#include <limits>
+#include <string>
 #include <algorithm>
+#include <numeric>
+#include <span>
 
 namespace algebra {
 
-    template <Numeric T, StorageOrder order>
+    // Index is the type of the entries of row_indices / col_indices: 32-bit
+    // indices cut the index traffic of the compressed kernels. Allocator is
+    // the allocator of the nodes of the map (e.g. PoolAllocator, see
+    // PooledMatrix), the compressed arrays always use std::allocator
+    template <Numeric T, StorageOrder order, IndexType Index = std::size_t,
+              typename Allocator = std::allocator<std::pair<const Key, T>>>
     class Matrix {
+        // matrices of the other storage order need access to the compressed arrays
+        template <Numeric U, StorageOrder other, IndexType I, typename A>
+        friend class Matrix;
+
+    public:
+        using map_type = std::map<Key, T, Compare<T, order>, Allocator>;
+
     private:
-        std::map<Key, T, Compare<T, order>> data;
-        std::size_t rows, cols;
-        bool compressed;
+        map_type data;
+        std::size_t rows = 0, cols = 0;
+        bool compressed = false;
+        // threads used by the compressed kernels, 1 means the serial ones
+        std::size_t num_threads = 1;
+        // the compressed lines split by nonzero count for num_threads, rebuilt
+        // by compress, flush_pending and set_num_threads instead of by every product
+        std::vector<std::size_t> line_bounds;
+        // triplet assembly (used instead of data when assembly == TRIPLET_ASSEMBLY)
+        Assembly assembly = MAP_ASSEMBLY;
+        std::vector<std::size_t> triplet_rows;
+        std::vector<std::size_t> triplet_cols;
+        std::vector<T> triplet_values;
+        // (i, j) -> position in the triplets, built lazily by the non-const operator()
+        std::unordered_map<Key, std::size_t, KeyHash> triplet_lookup;
+        bool lookup_built = false;
+        // false when add() may have appended repeated (i, j) pairs
+        bool triplets_unique = true;
         // compressed format
         std::vector<T> values;
-        std::vector<std::size_t> row_indices;
-        std::vector<std::size_t> col_indices;
+        std::vector<Index> row_indices;
+        std::vector<Index> col_indices;
+        // hybrid compressed mode: entries written into a compressed matrix
+        // outside its pattern, kept sorted in the order of the map. The
+        // products and norms read them next to the arrays; they are merged
+        // into the arrays in one pass (flush_pending) past the merge threshold,
+        // by compress() or uncompress(); const operations never merge them
+        std::vector<Key> pending_keys;
+        std::vector<T> pending_values;
+        std::size_t merge_threshold = 0;  // 0 means automatic, see pending_limit
 
     public:
         //CONSTUCTORS
@@ -34,23 +79,49 @@ namespace algebra {
         }
 
         //uncompressed constructor
-        Matrix(std::map<Key, T, Compare<T, order>> data, std::size_t rows, std::size_t cols) : 
-            data(data), 
+        Matrix(map_type data, std::size_t rows, std::size_t cols) : 
+            data(std::move(data)), 
             rows(rows), 
             cols(cols),
             compressed(false) {};
 
         //compressed constructor
-        Matrix(std::vector<T> values, std::vector<std::size_t> row_indices, std::vector<std::size_t> col_indices, std::size_t rows, std::size_t cols) : 
-            values(values), 
-            row_indices(row_indices), 
-            col_indices(col_indices),
+        Matrix(std::vector<T> values, std::vector<Index> row_indices, std::vector<Index> col_indices, std::size_t rows, std::size_t cols) : 
             rows(rows), 
             cols(cols),
-            compressed(true) {};
+            compressed(true),
+            values(std::move(values)), 
+            row_indices(std::move(row_indices)), 
+            col_indices(std::move(col_indices)) {
+            update_line_bounds();
+        };
+
+        // the same matrix with another allocator for the map: the entries of
+        // the map are copied, the triplets and compressed arrays moved
+        template <typename OtherAllocator>
+            requires (!std::is_same_v<OtherAllocator, Allocator>)
+        Matrix(Matrix<T, order, Index, OtherAllocator> other) :
+            data(other.data.begin(), other.data.end()),
+            rows(other.rows),
+            cols(other.cols),
+            compressed(other.compressed),
+            num_threads(other.num_threads),
+            line_bounds(std::move(other.line_bounds)),
+            assembly(other.assembly),
+            triplet_rows(std::move(other.triplet_rows)),
+            triplet_cols(std::move(other.triplet_cols)),
+            triplet_values(std::move(other.triplet_values)),
+            triplets_unique(other.triplets_unique),
+            values(std::move(other.values)),
+            row_indices(std::move(other.row_indices)),
+            col_indices(std::move(other.col_indices)),
+            pending_keys(std::move(other.pending_keys)),
+            pending_values(std::move(other.pending_values)),
+            merge_threshold(other.merge_threshold) {}
 
         //file reader constructor (defined in MatrixFileConstructor.hpp)
-        Matrix(const std::string& file_name);
+        //read_compressed builds the compressed arrays directly, skipping the map
+        Matrix(const std::string& file_name, bool read_compressed = false);
 
         void resize(std::size_t rows, std::size_t cols) {
             this->rows = rows;
@@ -59,64 +130,111 @@ namespace algebra {
 
         std::size_t get_num_non_zero() const {
             if (compressed) {
-                return values.size();
+                return values.size() + pending_values.size();
+            }
+            if (assembly == TRIPLET_ASSEMBLY) {
+                return triplet_values.size();  // repeated entries are counted until compress()
             }
             return data.size();
         }
 
+        // choose the uncompressed store, the current entries are moved to the new one
+        void set_assembly(Assembly new_assembly);
+
+        Assembly get_assembly() const {
+            return assembly;
+        }
+
+        // reserve space for nnz entries in the triplet buffer
+        void reserve(std::size_t nnz) {
+            if (assembly == TRIPLET_ASSEMBLY) {
+                triplet_rows.reserve(nnz);
+                triplet_cols.reserve(nnz);
+                triplet_values.reserve(nnz);
+            }
+        }
+
+        // accumulate v into (i, j); with triplet assembly this is a plain append,
+        // repeated entries are summed by compress()
+        void add(std::size_t i, std::size_t j, T v);
+
+        // on a compressed matrix this merges the pending entries, see flush_pending
         void compress() {
             if (is_compressed()) {
-                return;  // Already compressed
+                flush_pending();
+                return;
             }
+            ALGEBRA_PERF_REGION("compress");
+            check_index_range(rows, cols, get_num_non_zero());
 
-            if constexpr (order == ROW_MAJOR) {
-                
-                compressRowMajor();
-            } else if constexpr (order == COL_MAJOR) {
-                compressColMajor();
+            if (assembly == TRIPLET_ASSEMBLY) {
+                compressTriplets();
+            } else {
+                compressMap();
             }
 
-            // Clear the uncompressed format map
-            data.clear();
+            // Clear the uncompressed format map; assigning a new map also
+            // gives back the chunks of a pool allocator at once
+            data = map_type();
 
             compressed = true;
+            update_line_bounds();
         }
 
         void uncompress() {
             if (!is_compressed()) {
                 return;  // Already uncompressed
             }
+            ALGEBRA_PERF_REGION("uncompress");
+            flush_pending();
 
-            if constexpr (order == ROW_MAJOR) {
-                uncompressRowMajor();
-            } else if constexpr (order == COL_MAJOR) {
-                uncompressColMajor();
+            if (assembly == TRIPLET_ASSEMBLY) {
+                uncompressTriplets();
+            } else {
+                uncompressMap();
             }
 
-            // Clear the compressed format vectors
-            values.clear();
-            row_indices.clear();
-            col_indices.clear();
+            // Free the compressed format vectors
+            values = std::vector<T>();
+            row_indices = std::vector<Index>();
+            col_indices = std::vector<Index>();
 
             compressed = false;
+            update_line_bounds();
         }
 
         bool is_compressed() const {
             return compressed;
         }
 
+        // compressed with no pending entry: the getters give the whole matrix
+        bool is_fully_compressed() const {
+            return compressed && pending_keys.empty();
+        }
+
+        // merge the pending entries of a compressed matrix into the compressed
+        // arrays, in one pass over the lines from the first one touched
+        void flush_pending();
+
+        // entries written outside the pattern of the compressed matrix and not merged yet
+        std::size_t get_num_pending() const {
+            return pending_values.size();
+        }
+
+        // merge once more than n entries are pending (0: automatic, about
+        // sqrt(nnz) so that the inserts and the merges cost the same)
+        void set_merge_threshold(std::size_t n) {
+            merge_threshold = n;
+        }
+
         T operator()(std::size_t i, std::size_t j) const {
             if (i >= rows || j >= cols) 
                 throw std::out_of_range("Row or column is outside the matrix");            
             // Check if the matrix is compressed
             if (compressed) {
-                // Check the storage order of the matrix
-                if constexpr (order == StorageOrder::ROW_MAJOR) 
-                    return findElementRowMajor(i, j);
-
-                 else 
-                    return findElementColMajor(i, j);
-
+                return findElementCompressed(i, j);
+            } else if (assembly == TRIPLET_ASSEMBLY) {
+                return findElementTriplets(i, j);
             } else {
                  // If the matrix is not compressed, find the element in the data map
                 auto it = data.find(Key{i, j});
@@ -129,22 +247,25 @@ namespace algebra {
  
         }
 
+        // on a compressed matrix a new entry goes to the pending buffer: the
+        // reference is valid until the next new entry, flush_pending(),
+        // compress() or uncompress(), which may move the entries
         T& operator()(std::size_t i, std::size_t j) {
 
             // Check if the matrix is compressed
             if (compressed) {
-                // Check the storage order of the matrix
-                if constexpr (order == StorageOrder::ROW_MAJOR) 
-                    return findElementRowMajor(i, j);
-
-                else 
-                    return findElementColMajor(i, j);
-
+                // outside the matrix nothing is stored, the row/col pointers must
+                // not be read; inside, a new entry goes to the pending buffer
+                if (i >= rows || j >= cols)
+                    throw std::runtime_error("Element not found. Cannot change value of an element outside the compressed matrix. One may consider uncompressing the matrix");
+                return findElementCompressed(i, j);
             } else {
                 // If the matrix is not compressed, return a reference to the element in the data map
                 //here we check if i and j are greater than the rows and cols, in that case we resize the matrix
                 rows = i+1 > rows ? i+1 : rows;
                 cols = j+1 > cols ? j+1 : cols;
+                if (assembly == TRIPLET_ASSEMBLY)
+                    return findElementTriplets(i, j);
                 return data[Key{i,j}];
             }
         }
@@ -156,9 +277,31 @@ namespace algebra {
             return true;
         }
     
+        // values at the pairs (rows[k], cols[k]), T() where nothing is stored.
+        // Compressed, consecutive pairs in the same line with increasing inner
+        // index are found by galloping from the previous one, so pairs sorted
+        // by line (rows for ROW_MAJOR, columns for COL_MAJOR) cost O(log d)
+        // each, d the distance from the previous pair. Any order is accepted.
+        std::vector<T> lookup(std::span<const std::size_t> rows, std::span<const std::size_t> cols) const;
+
+        // the positions of the pairs in get_values(), get_num_non_zero() where
+        // nothing is stored: computed once, they give in-place updates of the
+        // values of a fixed pattern without further searches. The pending
+        // entries are merged first, so that every entry has a position
+        std::vector<std::size_t> find_positions(std::span<const std::size_t> rows, std::span<const std::size_t> cols);
+
+        // values[positions[k]] += increments[k], positions from find_positions
+        void add_at(std::span<const std::size_t> positions, std::span<const T> increments);
+
         //norm
         template <WhichNorm NORM>
         T norm() const {
+            ALGEBRA_PERF_REGION(NORM == WhichNorm::FROBENIUS ? "norm_frobenius"
+                                : NORM == WhichNorm::ONE     ? "norm_one"
+                                                             : "norm_max");
+            if (!is_compressed() && assembly == TRIPLET_ASSEMBLY)
+                return norm_triplets<NORM>();
+
             if constexpr (NORM == WhichNorm::FROBENIUS) {
                 if (!is_compressed()) {
                     return std::sqrt(std::accumulate(data.begin(), data.end(), 0.0,
@@ -166,10 +309,9 @@ namespace algebra {
                             return acc + std::norm(pair.second);
                         }));
                 } else {
-                    return std::sqrt(std::accumulate(values.begin(), values.end(), 0.0,
-                        [](double acc, const auto& value) {
-                            return acc + std::norm(value);
-                        }));
+                    auto add_norm = [](double acc, const auto& value) { return acc + std::norm(value); };
+                    return std::sqrt(std::accumulate(pending_values.begin(), pending_values.end(),
+                                                     std::accumulate(values.begin(), values.end(), 0.0, add_norm), add_norm));
                 }
 
             } else if constexpr (NORM == WhichNorm::ONE) {
@@ -196,18 +338,69 @@ namespace algebra {
         }
 
         friend std::vector<T> operator*(const Matrix& m, const std::vector<T>& v) {
+            ALGEBRA_PERF_REGION("spmv");
             if (!m.is_compressed()) {
+                if (m.assembly == TRIPLET_ASSEMBLY)
+                    return m._matrix_vector_triplets(v);
                 return m._matrix_vector_uncompressed(v);
             }
             else{
+                std::vector<T> out;
                 if constexpr (order == StorageOrder::ROW_MAJOR) {
-                    return m._matrix_vector_row_compressed_RowMajor(v);
+                    if (m.num_threads > 1)
+                        out = m._gather_product(m.row_indices, m.col_indices, v, m.rows);
+                    else
+                        out = m._matrix_vector_row_compressed_RowMajor(v);
                 }
-                else
-                    return m._matrix_vector_row_compressed_ColMajor(v);
+                else {
+                    if (m.num_threads > 1)
+                        out = m._scatter_product(m.col_indices, m.row_indices, v, m.rows);
+                    else
+                        out = m._matrix_vector_row_compressed_ColMajor(v);
+                }
+                m._add_pending_product<false>(v, out);
+                return out;
             }
         };
 
+        // multi-vector product A * X, X a dense block of right-hand sides: every
+        // nonzero is read once for all the columns of X
+        template <StorageOrder layout>
+        friend DenseBlock<T, layout> operator*(const Matrix& m, const DenseBlock<T, layout>& X) {
+            if (m.cols != X.get_rows())
+                throw std::invalid_argument("Matrix dimensions do not match for multiplication");
+            if (!m.is_fully_compressed()) {
+                Matrix m_compressed = m;
+                m_compressed.compress();
+                return m_compressed._matrix_block_compressed(X);
+            }
+            return m._matrix_block_compressed(X);
+        }
+
+        // y = alpha * A x + beta * y into a caller-provided output, without
+        // copying x. The line partition is kept with the matrix and the
+        // threads are those of the parallel::run pool, so the only allocations
+        // are the per-thread partial outputs of the parallel COL_MAJOR product.
+        // With beta == 0, y is only written.
+        void multiply(std::span<const T> x, std::span<T> y, T alpha = T(1), T beta = T(0)) const;
+
+        // A^T x without building the transpose: a scatter over the rows for
+        // ROW_MAJOR, a gather over the columns for COL_MAJOR
+        std::vector<T> multiply_transpose(const std::vector<T>& v) const {
+            return _transpose_product<false>(v);
+        }
+
+        // A^H x (conjugate transpose), the same as multiply_transpose for real T
+        std::vector<T> multiply_adjoint(const std::vector<T>& v) const {
+            return _transpose_product<is_complex_v<T>>(v);
+        }
+
+        // the same matrix in another StorageOrder. The compressed arrays are
+        // transposed directly with a counting sort, O(nnz + n), in parallel
+        // when set_num_threads is used; an uncompressed matrix stays uncompressed
+        template <StorageOrder new_order>
+        Matrix<T, new_order, Index, Allocator> convert() const;
+
         //printing
         friend std::ostream& operator<<(std::ostream& os, const Matrix& m) {
             std::string compr_string = m.is_compressed() ? "Compressed" : "Uncompressed";
@@ -226,6 +419,17 @@ namespace algebra {
                 for (const auto& c : m.col_indices) {
                     os << c << " ";
                 }
+                if (!m.pending_keys.empty()) {
+                    os << "\nPending entries: \n";
+                    for (std::size_t k = 0; k < m.pending_values.size(); ++k) {
+                        os << "(" << std::setw(2) << m.pending_keys[k][0] << ", " << std::setw(2) << m.pending_keys[k][1] << ")  ->  " << m.pending_values[k] << "\n";
+                    }
+                }
+            } else if (m.assembly == TRIPLET_ASSEMBLY) {
+                os << compr_string << " format (triplets) " << "with dimensions " << m.rows << "x" << m.cols << ":\n";
+                for (std::size_t k = 0; k < m.triplet_values.size(); ++k) {
+                    os << "(" << std::setw(2) << m.triplet_rows[k] << ", " << std::setw(2) << m.triplet_cols[k] << ")  ->  " << m.triplet_values[k] << "\n";
+                }
             } else {
                 os << compr_string << " format " << "with dimensions " << m.rows << "x" << m.cols << ":\n";
                 for (const auto& [k, v] : m.data) {
@@ -235,9 +439,30 @@ namespace algebra {
             return os;
         }
 
-        // extra
-        friend Matrix operator*(const Matrix& m1, const Matrix& m2) {
-            // ...
+        // matrix-matrix multiplication, the result has the storage order of m1.
+        // Compressed operands use a two-pass Gustavson SpGEMM, two uncompressed
+        // operands use the naive map-based product.
+        template <StorageOrder other>
+        friend Matrix operator*(const Matrix& m1, const Matrix<T, other, Index, Allocator>& m2) {
+            if (m1.get_cols() != m2.get_rows())
+                throw std::invalid_argument("Matrix dimensions do not match for multiplication");
+            if (!m1.is_compressed() && !m2.is_compressed() &&
+                m1.get_assembly() == MAP_ASSEMBLY && m2.get_assembly() == MAP_ASSEMBLY)
+                return m1._matrix_matrix_uncompressed(m2);
+
+            // an uncompressed operand, or one with pending entries, is compressed on a
+            // copy (m2 may still need it: a triplet m1 times a map m2 comes here)
+            if (!m1.is_fully_compressed()) {
+                Matrix m1_compressed = m1;
+                m1_compressed.compress();
+                return m1_compressed * m2;
+            }
+            if (!m2.is_fully_compressed()) {
+                Matrix<T, other, Index, Allocator> m2_compressed = m2;
+                m2_compressed.compress();
+                return m1._matrix_matrix_compressed(m2_compressed);
+            }
+            return m1._matrix_matrix_compressed(m2);
         }
 
         //getters
@@ -247,172 +472,145 @@ namespace algebra {
         std::size_t get_cols() const {
             return cols;
         }
-   
-    private:
-        //compression methods
-        void compressRowMajor() {
-            if (is_compressed())
-            {
-                return;
-            }
-            std::size_t num_non_zero = 0;
-            row_indices.resize(rows + 1, 0);
-            col_indices.resize(data.size());
-
-            std::transform(data.begin(), data.end(), 
-                std::back_inserter(values), [&](const auto& pair) { //all local variables accessible
-                const auto& [k, v] = pair;
-                col_indices[num_non_zero] = k[1];
-                row_indices[k[0] + 1] = ++num_non_zero; //increment the row index
-                return v; //this v is appended to values
-                }
-            );
 
-            // finalizing
-            compressed = true;
-            data.clear();
+        // compressed arrays (empty if the matrix is not compressed). They do
+        // not hold the pending entries: compress() or flush_pending() first
+        // (is_fully_compressed() tells whether they are the whole matrix)
+        const std::vector<T>& get_values() const {
+            return values;
         }
-
-        void compressColMajor() {
-            if (is_compressed())
-            {
-                return;
-            }
-            std::size_t num_non_zero = 0;
-            col_indices.resize(cols + 1, 0);
-            row_indices.resize(data.size());
-
-            std::transform(data.begin(), data.end(), 
-                std::back_inserter(values), [&](const auto& pair) { //all local variables accessible
-                const auto& [k, v] = pair;
-                row_indices[num_non_zero] = k[0];
-                col_indices[k[1] + 1] = ++num_non_zero; //increment the row index
-                return v; //this v is appended to values
-                }
-            );
-
-            // finalizing
-            compressed = true;
-            data.clear();
-
+        const std::vector<Index>& get_row_indices() const {
+            return row_indices;
         }
-
-        void uncompressRowMajor() {
-            if (!is_compressed())
-            {
-                return;
-            }                
-    
-            for (std::size_t row_idx = 0; row_idx < rows; ++row_idx) {
-                for (std::size_t col_idx = row_indices[row_idx]; col_idx < row_indices[row_idx + 1]; ++col_idx) {
-                    data[Key{row_idx, col_indices[col_idx]}] = values[col_idx];
-                }
-            }
-
-            row_indices.clear();
-            col_indices.clear();
-            values.clear();
-
-            // finalizing
-            compressed = false;
+        const std::vector<Index>& get_col_indices() const {
+            return col_indices;
         }
 
-        void uncompressColMajor() {
-            if (!is_compressed())
-            {
-                return;
-            }
-        
-            for (std::size_t col_idx = 0; col_idx < cols; ++col_idx) {
-                for (std::size_t row_idx = col_indices[col_idx]; row_idx < col_indices[col_idx + 1]; ++row_idx) {
-                data[Key{row_indices[row_idx], col_idx}] =values[row_idx];
-                }
-            }
-
-            row_indices.clear();
-            col_indices.clear();
-            values.clear();
-
-            // finalizing
-            compressed = false;
+        // parallel execution: number of threads used by the compressed
+        // matrix-vector product (0 means all hardware threads, 1 the serial kernels)
+        void set_num_threads(std::size_t n) {
+            num_threads = n == 0 ? parallel::hardware_threads() : n;
+            update_line_bounds();
+        }
+        std::size_t get_num_threads() const {
+            return num_threads;
+        }
+   
+    private:
+        void update_line_bounds() {
+            line_bounds = compressed ? kernels::balanced_partition<Index>(order == ROW_MAJOR ? row_indices : col_indices, num_threads)
+                                     : std::vector<std::size_t>();
+        }
 
-            // finalizing
-            compressed = false;
+        // line_bounds, or a partition built in scratch when the compressed
+        // arrays were set without updating it
+        std::span<const std::size_t> line_partition(std::vector<std::size_t>& scratch) const {
+            const std::span<const Index> ptr = order == ROW_MAJOR ? row_indices : col_indices;
+            if (line_bounds.size() == num_threads + 1 && line_bounds.back() + 1 == ptr.size())
+                return line_bounds;
+            scratch = kernels::balanced_partition<Index>(ptr, num_threads);
+            return scratch;
         }
 
+        // throws if the dimensions or the number of nonzeros do not fit in Index
+        static void check_index_range(std::size_t rows, std::size_t cols, std::size_t nnz) {
+            constexpr std::size_t max_index = std::numeric_limits<Index>::max();
+            if (rows >= max_index || cols >= max_index || nnz > max_index)
+                throw std::overflow_error("Matrix too large for the chosen index type: " + std::to_string(rows) + "x" +
+                                          std::to_string(cols) + " with " + std::to_string(nnz) + " non zeros");
+        }
 
-        //non const and const methods for retrieving elements in compressed matrix
-        T& findElementRowMajor(std::size_t row, std::size_t col) {
-            auto start = values.begin() + row_indices[row];
-            auto end = values.begin() + row_indices[row + 1];
+        //compression methods
+        void compressMap();
 
-            auto it = std::find_if(start, end, [&](const auto& value) {
-                std::size_t col_idx = &value - &values[0]; //index of the value in values
-                return col_indices[col_idx] == col;
-            });
+        // the compressed arrays are walked in the order of the map, so every
+        // entry is appended at the end of the tree: O(nnz) in total
+        void uncompressMap();
 
-            if (it != end) {
-                return *it;
-            }
-            else {
-                throw std::runtime_error("Element not found. Cannot change value of an element not stored. One may consider uncompressing the matrix");
-            }
+        template <bool conjugate>
+        std::vector<T> _transpose_product(const std::vector<T>& v) const {
+            if (!is_compressed())
+                return _matrix_transpose_vector_uncompressed<conjugate>(v);
+            std::vector<T> out;
+            if constexpr (order == StorageOrder::ROW_MAJOR)
+                out = _scatter_product<conjugate>(row_indices, col_indices, v, cols);
+            else
+                out = _gather_product<conjugate>(col_indices, row_indices, v, cols);
+            _add_pending_product<true, conjugate>(v, out);
+            return out;
         }
 
-        T& findElementColMajor(std::size_t row, std::size_t col) {               
-            auto start = values.begin() + col_indices[col];
-            auto end = values.begin() + col_indices[col + 1];
-
-            auto it = std::find_if(start, end, [&](const auto& value) {
-                std::size_t row_idx = &value - &values[0]; //index of the value in values
-                return row_indices[row_idx] == row;
-            });
-
-            if (it != end) {
-                return *it;
-            }
-            else {
-                throw std::runtime_error("Element not found. Cannot change value of an element not stored. One may consider uncompressing the matrix");
+        // out += alpha * P x, P the pending entries (P^T x, or P^H x, with transpose)
+        template <bool transpose, bool conjugate = false>
+        void _add_pending_product(std::span<const T> x, std::span<T> out, T alpha = T(1)) const {
+            for (std::size_t k = 0; k < pending_values.size(); ++k) {
+                const Key& key = pending_keys[k];
+                if constexpr (transpose)
+                    out[key[1]] += alpha * x[key[0]] * kernels::conj_if<conjugate>(pending_values[k]);
+                else
+                    out[key[0]] += alpha * x[key[1]] * pending_values[k];
             }
         }
 
-        T findElementRowMajor(std::size_t row, std::size_t col) const{
+        // pending entries past which they are merged
+        std::size_t pending_limit() const {
+            if (merge_threshold != 0)
+                return merge_threshold;
+            return std::max<std::size_t>(64, static_cast<std::size_t>(std::sqrt(static_cast<double>(values.size()))));
+        }
 
-            auto start = values.begin() + row_indices[row];
-            auto end = values.begin() + row_indices[row + 1];
+        //multi-vector product (defined below the class)
+        template <StorageOrder layout>
+        DenseBlock<T, layout> _matrix_block_compressed(const DenseBlock<T, layout>& X) const;
+
+        //triplet assembly (defined below the class)
+        void compressTriplets();
+        void uncompressTriplets();
+        void build_triplet_lookup();
+        T& findElementTriplets(std::size_t row, std::size_t col);
+        T findElementTriplets(std::size_t row, std::size_t col) const;
+        std::vector<T> _matrix_vector_triplets(const std::vector<T>& vec) const;
+        template <WhichNorm NORM>
+        T norm_triplets() const;
+
+        //retrieving elements in compressed matrix: binary search in the
+        //sorted line, the position in values or values.size() if not stored
+        std::size_t find_position(std::size_t row, std::size_t col) const {
+            const auto& ptr = order == ROW_MAJOR ? row_indices : col_indices;
+            const auto& idx = order == ROW_MAJOR ? col_indices : row_indices;
+            const std::size_t line = order == ROW_MAJOR ? row : col;
+            const std::size_t pos = kernels::find_in_line<Index>(idx, ptr[line], ptr[line + 1], order == ROW_MAJOR ? col : row);
+            return pos == ptr[line + 1] ? values.size() : pos;
+        }
 
-            auto it = std::find_if(start, end, [&](const auto& value) {
-                std::size_t col_idx = &value - &values[0]; //index of the value in values
-                return col_indices[col_idx] == col;
-            });
+        T& findElementCompressed(std::size_t row, std::size_t col) {
+            const std::size_t pos = find_position(row, col);
+            if (pos != values.size())
+                return values[pos];
+            return findElementPending(row, col);
+        }
 
-            if (it != end) {
-                return *it;
-            }
-            else {
-                return T();
-            }
+        T findElementCompressed(std::size_t row, std::size_t col) const {
+            const std::size_t pos = find_position(row, col);
+            return pos != values.size() ? values[pos] : findPendingValue(row, col);
         }
 
-        T findElementColMajor(std::size_t row, std::size_t col) const{              
-            auto start = values.begin() + col_indices[col];
-            auto end = values.begin() + col_indices[col + 1];
+        // the pending entry (row, col), T() if there is none; the buffer is not changed
+        T findPendingValue(std::size_t row, std::size_t col) const {
+            const Key key{row, col};
+            const auto it = std::lower_bound(pending_keys.begin(), pending_keys.end(), key, Compare<T, order>{});
+            return it != pending_keys.end() && *it == key ? pending_values[it - pending_keys.begin()] : T();
+        }
 
-            auto it = std::find_if(start, end, [&](const auto& value) {
-                std::size_t row_idx = &value - &values[0]; //index of the value in values
-                return row_indices[row_idx] == row;
-            });
+        // the pending entry (row, col), inserted with value T() if new (defined below the class)
+        T& findElementPending(std::size_t row, std::size_t col);
 
-            if (it != end) {
-                return *it;
-            }
-            else {
-                return T();
-            }
-        }
+        // f(k, position of the pair k) for every pair of the batched lookups (defined below the class)
+        template <typename F>
+        void for_each_position(std::span<const std::size_t> rows, std::span<const std::size_t> cols, F&& f) const;
         
         //matrix vector multiplication
-        std::vector<T> _matrix_vector_uncompressed(std::vector<T> vec) const {
+        std::vector<T> _matrix_vector_uncompressed(const std::vector<T>& vec) const {
             std::vector<T> out(rows, 0);
 
             for (const auto& [k, v] : data) {
@@ -422,7 +620,7 @@ namespace algebra {
             return out;
         }
 
-        std::vector<T> _matrix_vector_row_compressed_RowMajor(std::vector<T> vec) const {
+        std::vector<T> _matrix_vector_row_compressed_RowMajor(const std::vector<T>& vec) const {
 
             std::vector<T> out(rows, 0);
             for (std::size_t i = 0; i < rows; ++i) {
@@ -434,7 +632,7 @@ namespace algebra {
             return out;
         }
 
-        std::vector<T> _matrix_vector_row_compressed_ColMajor(std::vector<T> vec) const {
+        std::vector<T> _matrix_vector_row_compressed_ColMajor(const std::vector<T>& vec) const {
             std::vector<T> out(rows, 0);
             // iterate through the colums
             for (std::size_t col_idx = 0; col_idx < cols; ++col_idx) {
@@ -446,6 +644,64 @@ namespace algebra {
             return out;
             }
 
+        //matrix matrix multiplication (defined below the class)
+        template <StorageOrder other>
+        Matrix _matrix_matrix_uncompressed(const Matrix<T, other, Index, Allocator>& m2) const;
+
+        template <StorageOrder other>
+        Matrix _matrix_matrix_compressed(const Matrix<T, other, Index, Allocator>& m2) const;
+
+        // gather product over the lines of (ptr, idx): lines are split by nonzero
+        // count, every thread writes its own entries of out
+        template <bool conjugate = false>
+        std::vector<T> _gather_product(std::span<const Index> ptr, std::span<const Index> idx,
+                                       const std::vector<T>& vec, std::size_t n_out) const {
+            std::vector<T> out(n_out, 0);
+            std::vector<std::size_t> scratch;
+            const auto bounds = line_partition(scratch);
+            parallel::run(num_threads, [&](std::size_t t) {
+                kernels::spmv_gather<T, Index, conjugate>(ptr, idx, values, vec, out, bounds[t], bounds[t + 1]);
+            });
+            return out;
+        }
+
+        // scatter product over the lines of (ptr, idx): lines are split by nonzero
+        // count, every thread scatters into its own partial output, the partials
+        // are then summed in parallel
+        template <bool conjugate = false>
+        std::vector<T> _scatter_product(std::span<const Index> ptr, std::span<const Index> idx,
+                                        const std::vector<T>& vec, std::size_t n_out) const {
+            std::vector<std::size_t> scratch;
+            const auto bounds = line_partition(scratch);
+            std::vector<std::vector<T>> partial(num_threads, std::vector<T>(n_out, 0));
+            parallel::run(num_threads, [&](std::size_t t) {
+                kernels::spmv_scatter<T, Index, conjugate>(ptr, idx, values, vec, partial[t], bounds[t], bounds[t + 1]);
+            });
+
+            std::vector<T> out = std::move(partial[0]);
+            parallel::run(num_threads, [&](std::size_t t) {
+                const std::size_t begin = n_out * t / num_threads, end = n_out * (t + 1) / num_threads;
+                for (std::size_t p = 1; p < partial.size(); ++p)
+                    for (std::size_t i = begin; i < end; ++i)
+                        out[i] += partial[p][i];
+            });
+            return out;
+        }
+
+        // A^T x (A^H x) of an uncompressed matrix
+        template <bool conjugate>
+        std::vector<T> _matrix_transpose_vector_uncompressed(const std::vector<T>& vec) const {
+            std::vector<T> out(cols, 0);
+            if (assembly == TRIPLET_ASSEMBLY) {
+                for (std::size_t k = 0; k < triplet_values.size(); ++k)
+                    out[triplet_cols[k]] += vec[triplet_rows[k]] * kernels::conj_if<conjugate>(triplet_values[k]);
+            } else {
+                for (const auto& [k, v] : data)
+                    out[k[1]] += vec[k[0]] * kernels::conj_if<conjugate>(v);
+            }
+            return out;
+        }
+
         //norms
         T one_norm() const {
             std::vector<T> sum_col(cols, 0.0);
@@ -462,6 +718,8 @@ namespace algebra {
             for (std::size_t col_idx = 0; col_idx < col_indices.size(); ++col_idx) {
                 sum_col[col_indices[col_idx]] += std::abs(values[col_idx]);
             }
+            for (std::size_t k = 0; k < pending_values.size(); ++k)
+                sum_col[pending_keys[k][1]] += std::abs(pending_values[k]);
             return *std::max_element(std::begin(sum_col), std::end(sum_col), [](const T& a, const T& b) {
                 return std::norm(a) < std::norm(b);
             });
@@ -470,12 +728,15 @@ namespace algebra {
         T one_norm_compressed_ColMajor() const {
             // std::vector<T> sum_col(cols, 0.0);
             T out = 0;
+            std::size_t p = 0;  // the pending entries are sorted by column too
             for (std::size_t i = 0; i < cols; ++i) {
                 T sum = 0;
                 for (std::size_t j = col_indices[i]; j < col_indices[i + 1]; ++j) {
                     // sum_col[row_indices[j]] += std::abs(values[j]);
                     sum += std::abs(values[j]);
                 }
+                for (; p < pending_values.size() && pending_keys[p][1] == i; ++p)
+                    sum += std::abs(pending_values[p]);
                 out = std::max(out, sum,  [](const T& a, const T& b) {
                 return std::norm(a) < std::norm(b);});
 
@@ -503,6 +764,8 @@ namespace algebra {
                     sum_row[i] += std::abs(values[j]);
                 }
             }
+            for (std::size_t k = 0; k < pending_values.size(); ++k)
+                sum_row[pending_keys[k][0]] += std::abs(pending_values[k]);
             return *std::max_element(std::begin(sum_row), std::end(sum_row), [](const T& a, const T& b) {
                 return std::norm(a) < std::norm(b);
             });
@@ -515,12 +778,564 @@ namespace algebra {
                     sum_row[row_indices[j]] += std::abs(values[j]);
                 }
             }
+            for (std::size_t k = 0; k < pending_values.size(); ++k)
+                sum_row[pending_keys[k][0]] += std::abs(pending_values[k]);
             return *std::max_element(std::begin(sum_row), std::end(sum_row), [](const T& a, const T& b) {
                 return std::norm(a) < std::norm(b);
             });
         }
         
     };
+
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    T& Matrix<T, order, Index, Allocator>::findElementPending(std::size_t row, std::size_t col) {
+        const Key key{row, col};
+        auto it = std::lower_bound(pending_keys.begin(), pending_keys.end(), key, Compare<T, order>{});
+        if (it != pending_keys.end() && *it == key)
+            return pending_values[it - pending_keys.begin()];
+        // a full buffer is merged before the insert, so the new entry stays pending
+        if (pending_keys.size() >= pending_limit()) {
+            flush_pending();
+            it = pending_keys.begin();
+        }
+        const std::size_t pos = it - pending_keys.begin();
+        pending_keys.insert(it, key);
+        pending_values.insert(pending_values.begin() + pos, T());
+        return pending_values[pos];
+    }
+
+    // in place, from the back: the arrays grow by the pending entries and every
+    // line moves up by the number of pending entries of the lines below it,
+    // merged with its own ones. The lines before the first pending entry stay put
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    void Matrix<T, order, Index, Allocator>::flush_pending() {
+        if (pending_keys.empty())
+            return;
+        auto& ptr = order == ROW_MAJOR ? row_indices : col_indices;
+        auto& idx = order == ROW_MAJOR ? col_indices : row_indices;
+        auto outer = [](const Key& k) { return order == ROW_MAJOR ? k[0] : k[1]; };
+        auto inner = [](const Key& k) { return order == ROW_MAJOR ? k[1] : k[0]; };
+        check_index_range(rows, cols, values.size() + pending_values.size());
+
+        std::size_t p = pending_keys.size();
+        std::size_t dest = values.size() + p;
+        idx.resize(dest);
+        values.resize(dest);
+        for (std::size_t i = ptr.size() - 1; p > 0 && i-- > 0;) {
+            const std::size_t line_begin = ptr[i];
+            std::size_t k = ptr[i + 1];
+            ptr[i + 1] = static_cast<Index>(dest);
+            while (k > line_begin || (p > 0 && outer(pending_keys[p - 1]) == i)) {
+                if (p > 0 && outer(pending_keys[p - 1]) == i && (k == line_begin || inner(pending_keys[p - 1]) > idx[k - 1])) {
+                    --p;
+                    idx[--dest] = static_cast<Index>(inner(pending_keys[p]));
+                    values[dest] = pending_values[p];
+                } else {
+                    --k;
+                    idx[--dest] = idx[k];
+                    values[dest] = values[k];
+                }
+            }
+        }
+        pending_keys.clear();
+        pending_values.clear();
+        update_line_bounds();
+    }
+
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    template <typename F>
+    void Matrix<T, order, Index, Allocator>::for_each_position(std::span<const std::size_t> rows,
+                                                               std::span<const std::size_t> cols, F&& f) const {
+        if (rows.size() != cols.size())
+            throw std::invalid_argument("The row and column lists must have the same size");
+        const auto& ptr = order == ROW_MAJOR ? row_indices : col_indices;
+        const std::span<const Index> idx = order == ROW_MAJOR ? col_indices : row_indices;
+        // the previous pair: its line, inner index and where its search stopped
+        std::size_t line = 0, previous = 0, from = 0;
+        bool has_previous = false;
+        for (std::size_t k = 0; k < rows.size(); ++k) {
+            if (rows[k] >= this->rows || cols[k] >= this->cols)
+                throw std::out_of_range("Row or column is outside the matrix");
+            const std::size_t outer = order == ROW_MAJOR ? rows[k] : cols[k];
+            const std::size_t inner = order == ROW_MAJOR ? cols[k] : rows[k];
+            const std::size_t end = ptr[outer + 1];
+            // gallop forward in the same line, otherwise search the whole line
+            if (!has_previous || outer != line || inner < previous)
+                from = ptr[outer];
+            from = kernels::gallop<Index>(idx, from, end, inner);
+            f(k, from < end && idx[from] == inner ? from : values.size());
+            line = outer;
+            previous = inner;
+            has_previous = true;
+        }
+    }
+
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    std::vector<std::size_t> Matrix<T, order, Index, Allocator>::find_positions(std::span<const std::size_t> rows,
+                                                                                std::span<const std::size_t> cols) {
+        if (!compressed)
+            throw std::logic_error("Positions are only defined for a compressed matrix");
+        flush_pending();
+        std::vector<std::size_t> positions(rows.size());
+        for_each_position(rows, cols, [&](std::size_t k, std::size_t pos) { positions[k] = pos; });
+        return positions;
+    }
+
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    std::vector<T> Matrix<T, order, Index, Allocator>::lookup(std::span<const std::size_t> rows,
+                                                            std::span<const std::size_t> cols) const {
+        if (rows.size() != cols.size())
+            throw std::invalid_argument("The row and column lists must have the same size");
+        std::vector<T> out(rows.size());
+        if (!compressed) {
+            for (std::size_t k = 0; k < rows.size(); ++k)
+                out[k] = (*this)(rows[k], cols[k]);
+            return out;
+        }
+        // the pairs outside the arrays may be pending entries
+        for_each_position(rows, cols, [&](std::size_t k, std::size_t pos) {
+            out[k] = pos != values.size() ? values[pos] : findPendingValue(rows[k], cols[k]);
+        });
+        return out;
+    }
+
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    void Matrix<T, order, Index, Allocator>::add_at(std::span<const std::size_t> positions, std::span<const T> increments) {
+        if (positions.size() != increments.size())
+            throw std::invalid_argument("The position and increment lists must have the same size");
+        for (std::size_t k = 0; k < positions.size(); ++k) {
+            if (positions[k] >= values.size())
+                throw std::runtime_error("Element not found. Cannot change value of an element not stored. One may consider uncompressing the matrix");
+            values[positions[k]] += increments[k];
+        }
+    }
+
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    void Matrix<T, order, Index, Allocator>::multiply(std::span<const T> x, std::span<T> y, T alpha, T beta) const {
+        if (x.size() < cols || y.size() < rows)
+            throw std::invalid_argument("Vector sizes do not match the matrix dimensions");
+        ALGEBRA_PERF_REGION("spmv");
+
+        std::vector<std::size_t> scratch;
+        if (compressed && order == StorageOrder::ROW_MAJOR) {
+            const auto bounds = line_partition(scratch);
+            parallel::run(num_threads, [&](std::size_t t) {
+                kernels::spmv_gather_scaled<T, Index>(row_indices, col_indices, values, x, y, alpha, beta,
+                                                            bounds[t], bounds[t + 1]);
+            });
+            _add_pending_product<false>(x, y, alpha);
+            return;
+        }
+
+        // scatter paths: scale y first
+        if (beta == T(0))
+            std::fill(y.begin(), y.begin() + rows, T(0));
+        else if (beta != T(1))
+            std::for_each(y.begin(), y.begin() + rows, [beta](T& yi) { yi *= beta; });
+
+        if (compressed) {
+            const auto bounds = line_partition(scratch);
+            std::vector<std::vector<T>> partial(num_threads - 1, std::vector<T>(rows, 0));
+            parallel::run(num_threads, [&](std::size_t t) {
+                std::span<T> out = t == 0 ? y : std::span<T>(partial[t - 1]);
+                kernels::spmv_scatter_scaled<T, Index>(col_indices, row_indices, values, x, out, alpha,
+                                                             bounds[t], bounds[t + 1]);
+            });
+            for (const auto& p : partial)
+                for (std::size_t i = 0; i < rows; ++i)
+                    y[i] += p[i];
+            _add_pending_product<false>(x, y, alpha);
+        } else if (assembly == TRIPLET_ASSEMBLY) {
+            for (std::size_t k = 0; k < triplet_values.size(); ++k)
+                y[triplet_rows[k]] += alpha * x[triplet_cols[k]] * triplet_values[k];
+        } else {
+            for (const auto& [k, v] : data)
+                y[k[0]] += alpha * x[k[1]] * v;
+        }
+    }
+
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    template <StorageOrder new_order>
+    Matrix<T, new_order, Index, Allocator> Matrix<T, order, Index, Allocator>::convert() const {
+        if constexpr (new_order == order) {
+            return *this;
+        } else {
+            if (!pending_keys.empty()) {
+                Matrix flushed = *this;
+                flushed.flush_pending();
+                return flushed.template convert<new_order>();
+            }
+            Matrix<T, new_order, Index, Allocator> out;
+            out.rows = rows;
+            out.cols = cols;
+            out.num_threads = num_threads;
+            out.assembly = assembly;
+            if (!compressed) {
+                if (assembly == TRIPLET_ASSEMBLY) {
+                    out.triplet_rows = triplet_rows;
+                    out.triplet_cols = triplet_cols;
+                    out.triplet_values = triplet_values;
+                    out.triplets_unique = triplets_unique;
+                } else {
+                    out.data.insert(data.begin(), data.end());
+                }
+                return out;
+            }
+
+            if constexpr (order == StorageOrder::ROW_MAJOR)
+                kernels::transpose<T, Index>(rows, cols, row_indices, col_indices, values,
+                                                   out.col_indices, out.row_indices, out.values, num_threads);
+            else
+                kernels::transpose<T, Index>(cols, rows, col_indices, row_indices, values,
+                                                   out.row_indices, out.col_indices, out.values, num_threads);
+            out.compressed = true;
+            out.update_line_bounds();
+            return out;
+        }
+    }
+
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    template <StorageOrder layout>
+    DenseBlock<T, layout> Matrix<T, order, Index, Allocator>::_matrix_block_compressed(const DenseBlock<T, layout>& X) const {
+        constexpr bool row_major_block = layout == StorageOrder::ROW_MAJOR;
+        const std::size_t k = X.get_cols();
+        DenseBlock<T, layout> Y(rows, k);
+        std::span<const T> x = X.data();
+
+        if constexpr (order == StorageOrder::ROW_MAJOR) {
+            // rows are split by nonzero count, every thread writes its own rows of Y
+            std::vector<std::size_t> scratch;
+            const auto bounds = line_partition(scratch);
+            parallel::run(num_threads, [&](std::size_t t) {
+                kernels::spmm_gather<T, Index, row_major_block>(row_indices, col_indices, values, x, cols,
+                                                                      Y.data(), rows, k, bounds[t], bounds[t + 1]);
+            });
+        } else {
+            // columns are split by nonzero count, with more threads every one
+            // scatters into its own partial block, summed at the end
+            std::vector<std::size_t> scratch;
+            const auto bounds = line_partition(scratch);
+            std::vector<std::vector<T>> partial(num_threads - 1, std::vector<T>(rows * k, 0));
+            parallel::run(num_threads, [&](std::size_t t) {
+                std::span<T> y = t == 0 ? std::span<T>(Y.data()) : std::span<T>(partial[t - 1]);
+                kernels::spmm_scatter<T, Index, row_major_block>(col_indices, row_indices, values, x, cols,
+                                                                       y, rows, k, bounds[t], bounds[t + 1]);
+            });
+            for (const auto& p : partial)
+                for (std::size_t i = 0; i < p.size(); ++i)
+                    Y.data()[i] += p[i];
+        }
+        return Y;
+    }
+
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    void Matrix<T, order, Index, Allocator>::set_assembly(Assembly new_assembly) {
+        if (new_assembly == assembly)
+            return;
+        if (!compressed) {
+            if (new_assembly == TRIPLET_ASSEMBLY) {
+                reserve(data.size());
+                for (const auto& [k, v] : data) {
+                    triplet_rows.push_back(k[0]);
+                    triplet_cols.push_back(k[1]);
+                    triplet_values.push_back(v);
+                }
+                data = map_type();
+                triplets_unique = true;
+            } else {
+                for (std::size_t k = 0; k < triplet_values.size(); ++k)
+                    data[Key{triplet_rows[k], triplet_cols[k]}] += triplet_values[k];
+                triplet_rows.clear();
+                triplet_cols.clear();
+                triplet_values.clear();
+                triplet_lookup.clear();
+                lookup_built = false;
+            }
+        }
+        assembly = new_assembly;
+    }
+
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    void Matrix<T, order, Index, Allocator>::add(std::size_t i, std::size_t j, T v) {
+        if (compressed || assembly == MAP_ASSEMBLY || lookup_built) {
+            (*this)(i, j) += v;
+            return;
+        }
+        rows = i + 1 > rows ? i + 1 : rows;
+        cols = j + 1 > cols ? j + 1 : cols;
+        triplet_rows.push_back(i);
+        triplet_cols.push_back(j);
+        triplet_values.push_back(v);
+        triplets_unique = false;
+    }
+
+    // count, scan, fill. The map is cut at the first key of a line
+    // (lower_bound), so every thread walks its own lines: the threads count
+    // the entries of their lines, the counts are scanned into the pointer
+    // array, then every thread copies its lines, now split by nonzero count,
+    // to their final place. A single thread counts and copies in one pass.
+    // The arrays are the same for every number of threads.
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    void Matrix<T, order, Index, Allocator>::compressMap() {
+        const std::size_t n_outer = order == ROW_MAJOR ? rows : cols;
+        auto& ptr = order == ROW_MAJOR ? row_indices : col_indices;
+        auto& idx = order == ROW_MAJOR ? col_indices : row_indices;
+        auto outer = [](const Key& k) { return order == ROW_MAJOR ? k[0] : k[1]; };
+        auto inner = [](const Key& k) { return order == ROW_MAJOR ? k[1] : k[0]; };
+        auto line_begin = [this](std::size_t line) {
+            return data.lower_bound(order == ROW_MAJOR ? Key{line, 0} : Key{0, line});
+        };
+
+        ptr.assign(n_outer + 1, 0);
+        idx.resize(data.size());
+        values.resize(data.size());
+
+        // below a few thousand entries per thread starting the threads costs more
+        constexpr std::size_t min_entries_per_thread = 1 << 14;
+        if (num_threads <= 1 || n_outer < num_threads || data.size() < min_entries_per_thread * num_threads) {
+            std::size_t k = 0;
+            for (const auto& [key, v] : data) {
+                ++ptr[outer(key) + 1];
+                idx[k] = static_cast<Index>(inner(key));
+                values[k++] = v;
+            }
+            for (std::size_t i = 0; i < n_outer; ++i)
+                ptr[i + 1] += ptr[i];
+            return;
+        }
+
+        // lines of the counting pass: the nonzeros per line are not known yet
+        parallel::run(num_threads, [&](std::size_t t) {
+            const auto last = line_begin(n_outer * (t + 1) / num_threads);
+            for (auto it = line_begin(n_outer * t / num_threads); it != last; ++it)
+                ++ptr[outer(it->first) + 1];
+        });
+        for (std::size_t i = 0; i < n_outer; ++i)
+            ptr[i + 1] += ptr[i];
+
+        const auto bounds = kernels::balanced_partition<Index>(ptr, num_threads);
+        parallel::run(num_threads, [&](std::size_t t) {
+            const auto last = line_begin(bounds[t + 1]);
+            std::size_t k = ptr[bounds[t]];
+            for (auto it = line_begin(bounds[t]); it != last; ++it, ++k) {
+                idx[k] = static_cast<Index>(inner(it->first));
+                values[k] = it->second;
+            }
+        });
+    }
+
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    void Matrix<T, order, Index, Allocator>::uncompressMap() {
+        const auto& ptr = order == ROW_MAJOR ? row_indices : col_indices;
+        const auto& idx = order == ROW_MAJOR ? col_indices : row_indices;
+        for (std::size_t i = 0; i + 1 < ptr.size(); ++i) {
+            for (std::size_t k = ptr[i]; k < ptr[i + 1]; ++k) {
+                const Key key = order == ROW_MAJOR ? Key{i, idx[k]} : Key{idx[k], i};
+                data.emplace_hint(data.end(), key, values[k]);
+            }
+        }
+    }
+
+    // counting sort by the major index, then every line is sorted and repeated entries are summed
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    void Matrix<T, order, Index, Allocator>::compressTriplets() {
+        std::vector<Index> ptr, idx;
+        const std::size_t n_outer = order == ROW_MAJOR ? rows : cols;
+        const auto& outer = order == ROW_MAJOR ? triplet_rows : triplet_cols;
+        const auto& inner = order == ROW_MAJOR ? triplet_cols : triplet_rows;
+        kernels::triplets_to_lines<T, Index>(n_outer, outer, inner, triplet_values, ptr, idx, values);
+        if (kernels::sort_lines<T, Index>(ptr, idx, values, 0, n_outer) != 0)
+            kernels::combine_duplicates(ptr, idx, values, [](const T& a, const T& b) { return a + b; });
+
+        if constexpr (order == ROW_MAJOR) {
+            row_indices = std::move(ptr);
+            col_indices = std::move(idx);
+        } else {
+            col_indices = std::move(ptr);
+            row_indices = std::move(idx);
+        }
+
+        triplet_rows = std::vector<std::size_t>();
+        triplet_cols = std::vector<std::size_t>();
+        triplet_values = std::vector<T>();
+        triplet_lookup = std::unordered_map<Key, std::size_t, KeyHash>();
+        lookup_built = false;
+        triplets_unique = true;
+        compressed = true;
+    }
+
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    void Matrix<T, order, Index, Allocator>::uncompressTriplets() {
+        const auto& ptr = order == ROW_MAJOR ? row_indices : col_indices;
+        const auto& idx = order == ROW_MAJOR ? col_indices : row_indices;
+        auto& outer = order == ROW_MAJOR ? triplet_rows : triplet_cols;
+        auto& inner = order == ROW_MAJOR ? triplet_cols : triplet_rows;
+        outer.resize(values.size());
+        for (std::size_t i = 0; i + 1 < ptr.size(); ++i)
+            std::fill(outer.begin() + ptr[i], outer.begin() + ptr[i + 1], i);
+        inner.assign(idx.begin(), idx.end());
+        triplet_values = values;
+        triplets_unique = true;
+        lookup_built = false;
+        compressed = false;
+    }
+
+    // hash every triplet, summing repeated ones into their first occurrence
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    void Matrix<T, order, Index, Allocator>::build_triplet_lookup() {
+        triplet_lookup.clear();
+        triplet_lookup.reserve(triplet_values.size());
+        std::size_t pos = 0;
+        for (std::size_t k = 0; k < triplet_values.size(); ++k) {
+            auto [it, inserted] = triplet_lookup.try_emplace(Key{triplet_rows[k], triplet_cols[k]}, pos);
+            if (inserted) {
+                triplet_rows[pos] = triplet_rows[k];
+                triplet_cols[pos] = triplet_cols[k];
+                triplet_values[pos] = triplet_values[k];
+                ++pos;
+            } else {
+                triplet_values[it->second] += triplet_values[k];
+            }
+        }
+        triplet_rows.resize(pos);
+        triplet_cols.resize(pos);
+        triplet_values.resize(pos);
+        lookup_built = true;
+        triplets_unique = true;
+    }
+
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    T& Matrix<T, order, Index, Allocator>::findElementTriplets(std::size_t row, std::size_t col) {
+        if (!lookup_built)
+            build_triplet_lookup();
+        auto [it, inserted] = triplet_lookup.try_emplace(Key{row, col}, triplet_values.size());
+        if (inserted) {
+            triplet_rows.push_back(row);
+            triplet_cols.push_back(col);
+            triplet_values.push_back(T());
+        }
+        return triplet_values[it->second];
+    }
+
+    // without the lookup the buffer is scanned, repeated entries are summed
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    T Matrix<T, order, Index, Allocator>::findElementTriplets(std::size_t row, std::size_t col) const {
+        if (lookup_built) {
+            auto it = triplet_lookup.find(Key{row, col});
+            return it != triplet_lookup.end() ? triplet_values[it->second] : T();
+        }
+        T out = T();
+        for (std::size_t k = 0; k < triplet_values.size(); ++k) {
+            if (triplet_rows[k] == row && triplet_cols[k] == col)
+                out += triplet_values[k];
+        }
+        return out;
+    }
+
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    std::vector<T> Matrix<T, order, Index, Allocator>::_matrix_vector_triplets(const std::vector<T>& vec) const {
+        std::vector<T> out(rows, 0);
+        for (std::size_t k = 0; k < triplet_values.size(); ++k) {
+            out[triplet_rows[k]] += vec[triplet_cols[k]] * triplet_values[k];
+        }
+        return out;
+    }
+
+    // repeated entries must be summed before taking absolute values, in that
+    // case the norm is computed on a compressed copy
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    template <WhichNorm NORM>
+    T Matrix<T, order, Index, Allocator>::norm_triplets() const {
+        if (!triplets_unique) {
+            Matrix copy = *this;
+            copy.compress();
+            return copy.template norm<NORM>();
+        }
+        auto norm_less = [](const T& a, const T& b) { return std::norm(a) < std::norm(b); };
+
+        if constexpr (NORM == WhichNorm::FROBENIUS) {
+            return std::sqrt(std::accumulate(triplet_values.begin(), triplet_values.end(), 0.0,
+                [](double acc, const auto& value) {
+                    return acc + std::norm(value);
+                }));
+        } else if constexpr (NORM == WhichNorm::ONE) {
+            std::vector<T> sum_col(cols, 0);
+            for (std::size_t k = 0; k < triplet_values.size(); ++k)
+                sum_col[triplet_cols[k]] += std::abs(triplet_values[k]);
+            return *std::max_element(sum_col.begin(), sum_col.end(), norm_less);
+        } else {
+            std::vector<T> sum_row(rows, 0);
+            for (std::size_t k = 0; k < triplet_values.size(); ++k)
+                sum_row[triplet_rows[k]] += std::abs(triplet_values[k]);
+            return *std::max_element(sum_row.begin(), sum_row.end(), norm_less);
+        }
+    }
+
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    template <StorageOrder other>
+    Matrix<T, order, Index, Allocator> Matrix<T, order, Index, Allocator>::_matrix_matrix_uncompressed(const Matrix<T, other, Index, Allocator>& m2) const {
+        map_type out;
+
+        // for every (i, k) -> a we need the row k of m2, which is contiguous in a row ordered map
+        auto multiply = [&](const auto& m2_rows) {
+            for (const auto& [k1, a] : data) {
+                for (auto it = m2_rows.lower_bound(Key{k1[1], 0}); it != m2_rows.end() && it->first[0] == k1[1]; ++it) {
+                    out[Key{k1[0], it->first[1]}] += a * it->second;
+                }
+            }
+        };
+
+        if constexpr (other == StorageOrder::ROW_MAJOR)
+            multiply(m2.data);
+        else
+            multiply(std::map<Key, T>(m2.data.begin(), m2.data.end()));
+
+        return Matrix(std::move(out), rows, m2.cols);
+    }
+
+    template <Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+    template <StorageOrder other>
+    Matrix<T, order, Index, Allocator> Matrix<T, order, Index, Allocator>::_matrix_matrix_compressed(const Matrix<T, other, Index, Allocator>& m2) const {
+        using Span = std::span<const Index>;
+        std::vector<Index> c_ptr, c_idx;
+        std::vector<T> c_val;
+
+        // B is needed in the same compressed layout as A, transposed if the orders differ
+        std::vector<Index> t_ptr, t_idx;
+        std::vector<T> t_val;
+        Span b_ptr, b_idx;
+        std::span<const T> b_val;
+        if constexpr (other == order) {
+            b_ptr = order == StorageOrder::ROW_MAJOR ? Span(m2.row_indices) : Span(m2.col_indices);
+            b_idx = order == StorageOrder::ROW_MAJOR ? Span(m2.col_indices) : Span(m2.row_indices);
+            b_val = m2.values;
+        } else {
+            if constexpr (other == StorageOrder::ROW_MAJOR)
+                kernels::transpose<T, Index>(m2.rows, m2.cols, m2.row_indices, m2.col_indices, m2.values, t_ptr, t_idx, t_val, num_threads);
+            else
+                kernels::transpose<T, Index>(m2.cols, m2.rows, m2.col_indices, m2.row_indices, m2.values, t_ptr, t_idx, t_val, num_threads);
+            b_ptr = t_ptr; b_idx = t_idx; b_val = t_val;
+        }
+
+        if constexpr (order == StorageOrder::ROW_MAJOR) {
+            // C = A * B row by row
+            kernels::spgemm_symbolic<Index>(rows, m2.cols, row_indices, col_indices, b_ptr, b_idx, c_ptr);
+            kernels::spgemm_numeric<T, Index>(rows, m2.cols, row_indices, col_indices, values,
+                                                    b_ptr, b_idx, b_val, Span(c_ptr), c_idx, c_val);
+            return Matrix(std::move(c_val), std::move(c_ptr), std::move(c_idx), rows, m2.cols);
+        } else {
+            // the CSC arrays of C are the CSR arrays of C^T = B^T * A^T
+            kernels::spgemm_symbolic<Index>(m2.cols, rows, b_ptr, b_idx, col_indices, row_indices, c_ptr);
+            kernels::spgemm_numeric<T, Index>(m2.cols, rows, b_ptr, b_idx, b_val,
+                                                    col_indices, row_indices, values, Span(c_ptr), c_idx, c_val);
+            return Matrix(std::move(c_val), std::move(c_idx), std::move(c_ptr), rows, m2.cols);
+        }
+    }
+
+    // Matrix whose map nodes come from a NodePool: assembly does not go to the
+    // global allocator for every entry, and compress() frees the map at once
+    template <Numeric T, StorageOrder order, IndexType Index = std::size_t>
+    using PooledMatrix = Matrix<T, order, Index, PoolAllocator<std::pair<const Key, T>>>;
 }
 
 
@@ -0,0 +1,256 @@
+#ifndef MATRIX_BINARY_IO_HPP
+#define MATRIX_BINARY_IO_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "MappedFile.hpp"
+#include "Matrix.hpp"
+#include "Parallel.hpp"
+#include "SparseKernels.hpp"
+#include "Utils.hpp"
+
+namespace algebra {
+
+/**
+ * @brief Native binary format of a compressed matrix.
+ *
+ * Layout: a 128 bytes header followed by the values, the row_indices and the
+ * col_indices arrays, each one starting at an offset multiple of
+ * binary::alignment so that a memory mapping of the file can be used in place.
+ * For ROW_MAJOR row_indices has rows + 1 entries and col_indices nnz entries,
+ * for COL_MAJOR the other way round.
+ */
+namespace binary {
+
+    inline constexpr char magic[8] = {'S', 'P', 'M', 'A', 'T', 'B', 'I', 'N'};
+    inline constexpr std::uint32_t version = 1;
+    inline constexpr std::uint32_t byte_order_mark = 0x01020304;
+    inline constexpr std::uint64_t alignment = 64;
+
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byte_order;
+        std::uint32_t value_type;   // see type_code
+        std::uint32_t order;        // StorageOrder
+        std::uint32_t index_width;  // bytes of an index
+        std::uint32_t reserved;
+        std::uint64_t rows, cols, nnz;
+        std::uint64_t values_offset, row_indices_offset, col_indices_offset;
+        std::uint64_t row_indices_size, col_indices_size;
+        char padding[32];
+    };
+    static_assert(sizeof(Header) == 128);
+
+    //! (kind << 8) | sizeof, kind: 0 signed integer, 1 unsigned integer, 2 floating point, 3 complex
+    template <Numeric T>
+    constexpr std::uint32_t type_code() {
+        std::uint32_t kind;
+        if constexpr (is_complex_v<T>) kind = 3;
+        else if constexpr (std::is_floating_point_v<T>) kind = 2;
+        else if constexpr (std::is_unsigned_v<T>) kind = 1;
+        else kind = 0;
+        return (kind << 8) | static_cast<std::uint32_t>(sizeof(T));
+    }
+
+    inline std::uint64_t align_up(std::uint64_t offset) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    //! true if count items of width bytes starting at offset lie inside a file of file_size bytes, without overflow
+    inline bool fits(std::uint64_t offset, std::uint64_t count, std::uint64_t width, std::uint64_t file_size) {
+        return offset <= file_size && count <= (file_size - offset) / width;
+    }
+
+    //! check the header against the requested matrix type and the file size, throwing on mismatch
+    template <Numeric T, StorageOrder order, IndexType Index>
+    void check_header(const Header& header, std::size_t file_size, const std::string& file_name) {
+        if (file_size < sizeof(Header) || std::memcmp(header.magic, magic, sizeof(magic)) != 0)
+            throw std::runtime_error("Not a binary matrix file: " + file_name);
+        if (header.version != version)
+            throw std::runtime_error("Unsupported binary matrix version " + std::to_string(header.version) + " in " + file_name);
+        if (header.byte_order != byte_order_mark)
+            throw std::runtime_error("Binary matrix file written with a different byte order: " + file_name);
+        if (header.value_type != type_code<T>())
+            throw std::runtime_error("Binary matrix file " + file_name + " stores a different value type");
+        if (header.order != static_cast<std::uint32_t>(order))
+            throw std::runtime_error("Binary matrix file " + file_name + " stores a different StorageOrder");
+        if (header.index_width != sizeof(Index))
+            throw std::runtime_error("Binary matrix file " + file_name + " stores a different index width");
+
+        // the arrays: sizes consistent with the dimensions, aligned and inside the file
+        constexpr std::uint64_t max_index = std::numeric_limits<Index>::max();
+        const std::uint64_t n_outer = order == ROW_MAJOR ? header.rows : header.cols;
+        const std::uint64_t ptr_size = order == ROW_MAJOR ? header.row_indices_size : header.col_indices_size;
+        const std::uint64_t idx_size = order == ROW_MAJOR ? header.col_indices_size : header.row_indices_size;
+        if (header.rows >= max_index || header.cols >= max_index || header.nnz > max_index ||
+            ptr_size != n_outer + 1 || idx_size != header.nnz)
+            throw std::runtime_error("Inconsistent array sizes in binary matrix file: " + file_name);
+        for (std::uint64_t offset : {header.values_offset, header.row_indices_offset, header.col_indices_offset})
+            if (offset % alignment != 0 || offset < sizeof(Header))
+                throw std::runtime_error("Misaligned array in binary matrix file: " + file_name);
+        if (!fits(header.values_offset, header.nnz, sizeof(T), file_size) ||
+            !fits(header.row_indices_offset, header.row_indices_size, sizeof(Index), file_size) ||
+            !fits(header.col_indices_offset, header.col_indices_size, sizeof(Index), file_size))
+            throw std::runtime_error("Truncated binary matrix file: " + file_name);
+    }
+
+    /**
+     * @brief Check the compressed arrays of a file, O(n + nnz): the pointers
+     * start at 0, never decrease and end at nnz, the inner indices are below
+     * n_inner. The kernels then only read inside the arrays and the vectors.
+     */
+    template <IndexType Index>
+    void check_arrays(std::span<const Index> ptr, std::span<const Index> idx, std::size_t n_inner,
+                      const std::string& file_name) {
+        bool valid = !ptr.empty() && ptr.front() == 0 && ptr.back() == idx.size();
+        for (std::size_t i = 1; valid && i < ptr.size(); ++i)
+            valid = ptr[i - 1] <= ptr[i];
+        if (!valid)
+            throw std::runtime_error("Corrupt pointer array in binary matrix file: " + file_name);
+        if (std::any_of(idx.begin(), idx.end(), [n_inner](Index j) { return j >= n_inner; }))
+            throw std::runtime_error("Index outside the matrix in binary matrix file: " + file_name);
+    }
+
+}  // namespace binary
+
+/**
+ * @brief Write a matrix in the native binary format.
+ *
+ * An uncompressed matrix is compressed on a copy first.
+ */
+template <Numeric T, StorageOrder order, IndexType Index>
+void write_binary(const Matrix<T, order, Index>& m, const std::string& file_name) {
+    if (!m.is_fully_compressed()) {
+        Matrix<T, order, Index> m_compressed = m;
+        m_compressed.compress();
+        write_binary(m_compressed, file_name);
+        return;
+    }
+
+    const auto& values = m.get_values();
+    const auto& row_indices = m.get_row_indices();
+    const auto& col_indices = m.get_col_indices();
+
+    binary::Header header{};
+    std::memcpy(header.magic, binary::magic, sizeof(binary::magic));
+    header.version = binary::version;
+    header.byte_order = binary::byte_order_mark;
+    header.value_type = binary::type_code<T>();
+    header.order = static_cast<std::uint32_t>(order);
+    header.index_width = sizeof(Index);
+    header.rows = m.get_rows();
+    header.cols = m.get_cols();
+    header.nnz = values.size();
+    header.row_indices_size = row_indices.size();
+    header.col_indices_size = col_indices.size();
+    header.values_offset = binary::align_up(sizeof(binary::Header));
+    header.row_indices_offset = binary::align_up(header.values_offset + values.size() * sizeof(T));
+    header.col_indices_offset = binary::align_up(header.row_indices_offset + row_indices.size() * sizeof(Index));
+
+    std::ofstream file(file_name, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open file: " + file_name);
+    }
+    const char zeros[binary::alignment] = {};
+    auto write_at = [&](std::uint64_t offset, const void* data, std::size_t bytes) {
+        const auto pos = static_cast<std::uint64_t>(file.tellp());
+        file.write(zeros, static_cast<std::streamsize>(offset - pos));
+        file.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+    };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    write_at(header.values_offset, values.data(), values.size() * sizeof(T));
+    write_at(header.row_indices_offset, row_indices.data(), row_indices.size() * sizeof(Index));
+    write_at(header.col_indices_offset, col_indices.data(), col_indices.size() * sizeof(Index));
+    if (!file) {
+        throw std::runtime_error("Failed to write file: " + file_name);
+    }
+}
+
+/**
+ * @brief Compressed matrix living in a memory mapped binary file.
+ *
+ * No array is copied: the kernels read straight from the mapping. Opening
+ * the file checks the header and, in one pass, the index arrays (so that a
+ * corrupt file cannot make the product read outside them); the values are
+ * faulted in by the first product. The object owns the mapping and is read-only.
+ */
+template <Numeric T, StorageOrder order, IndexType Index = std::size_t>
+class MappedMatrix {
+public:
+    explicit MappedMatrix(const std::string& file_name) : file(file_name) {
+        if (file.size() < sizeof(binary::Header))
+            throw std::runtime_error("Not a binary matrix file: " + file_name);
+        std::memcpy(&header, file.data(), sizeof(header));
+        binary::check_header<T, order, Index>(header, file.size(), file_name);
+
+        values = {reinterpret_cast<const T*>(file.data() + header.values_offset), header.nnz};
+        row_indices = {reinterpret_cast<const Index*>(file.data() + header.row_indices_offset), header.row_indices_size};
+        col_indices = {reinterpret_cast<const Index*>(file.data() + header.col_indices_offset), header.col_indices_size};
+        if constexpr (order == ROW_MAJOR)
+            binary::check_arrays<Index>(row_indices, col_indices, header.cols, file_name);
+        else
+            binary::check_arrays<Index>(col_indices, row_indices, header.rows, file_name);
+    }
+
+    std::size_t get_rows() const { return header.rows; }
+    std::size_t get_cols() const { return header.cols; }
+    std::size_t get_num_non_zero() const { return header.nnz; }
+
+    std::span<const T> get_values() const { return values; }
+    std::span<const Index> get_row_indices() const { return row_indices; }
+    std::span<const Index> get_col_indices() const { return col_indices; }
+
+    void set_num_threads(std::size_t n) { num_threads = n == 0 ? parallel::hardware_threads() : n; }
+    std::size_t get_num_threads() const { return num_threads; }
+
+    //! copy the arrays into an ordinary compressed Matrix
+    Matrix<T, order, Index> to_matrix() const {
+        return Matrix<T, order, Index>(std::vector<T>(values.begin(), values.end()),
+                                       std::vector<Index>(row_indices.begin(), row_indices.end()),
+                                       std::vector<Index>(col_indices.begin(), col_indices.end()),
+                                       header.rows, header.cols);
+    }
+
+    friend std::vector<T> operator*(const MappedMatrix& m, const std::vector<T>& v) {
+        std::vector<T> out(m.header.rows, 0);
+        if constexpr (order == StorageOrder::ROW_MAJOR) {
+            const auto bounds = kernels::balanced_partition<Index>(m.row_indices, m.num_threads);
+            parallel::run(m.num_threads, [&](std::size_t t) {
+                kernels::spmv_gather<T, Index>(m.row_indices, m.col_indices, m.values, v, out, bounds[t], bounds[t + 1]);
+            });
+        } else {
+            kernels::spmv_scatter<T, Index>(m.col_indices, m.row_indices, m.values, v, out, 0, m.header.cols);
+        }
+        return out;
+    }
+
+private:
+    MappedFile file;
+    binary::Header header{};
+    std::span<const T> values;
+    std::span<const Index> row_indices;
+    std::span<const Index> col_indices;
+    std::size_t num_threads = 1;
+};
+
+/**
+ * @brief Read a matrix in the native binary format into an ordinary (owning)
+ * compressed Matrix. Use MappedMatrix to avoid the copy.
+ */
+template <Numeric T, StorageOrder order, IndexType Index = std::size_t>
+Matrix<T, order, Index> read_binary(const std::string& file_name) {
+    return MappedMatrix<T, order, Index>(file_name).to_matrix();
+}
+
+}  // namespace algebra
+
+#endif
@@ -1,66 +1,397 @@
 #ifndef MATRIX_FILE_CONSTRUCTOR_HPP
 #define MATRIX_FILE_CONSTRUCTOR_HPP
 
+#include <algorithm>
 #include <array>
-#include <fstream>
+#include <cctype>
+#include <charconv>
 #include <iostream>
 #include <map>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
+#include "MappedFile.hpp"
 #include "Matrix.hpp"
+#include "Parallel.hpp"
+#include "SparseKernels.hpp"
 #include "Utils.hpp"
 using namespace algebra;
 
 namespace algebra {
 
+// field and symmetry qualifiers of the %%MatrixMarket banner
+enum MarketField {
+    REAL,
+    INTEGER,
+    COMPLEX,
+    PATTERN
+};
+
+enum MarketSymmetry {
+    GENERAL,
+    SYMMETRIC,
+    SKEW_SYMMETRIC,
+    HERMITIAN
+};
+
+struct MarketHeader {
+    MarketField field = REAL;
+    MarketSymmetry symmetry = GENERAL;
+    std::size_t rows = 0, cols = 0, num_entries = 0;
+    std::size_t data_begin = 0;  // offset of the first entry line
+};
+
+namespace market {
+
+    inline const char* skip_blanks(const char* p, const char* end) {
+        while (p != end && (*p == ' ' || *p == '\t' || *p == '\r'))
+            ++p;
+        return p;
+    }
+
+    //! parse one number with std::from_chars, throwing on malformed input
+    template <typename N>
+    const char* parse_number(const char* p, const char* end, N& number) {
+        p = skip_blanks(p, end);
+        if (p != end && *p == '+')
+            ++p;
+        auto [ptr, ec] = std::from_chars(p, end, number);
+        if (ec != std::errc()) {
+            throw std::runtime_error("Malformed Matrix Market entry: " + std::string(p, std::find(p, end, '\n')));
+        }
+        return ptr;
+    }
+
+    //! parse the value of an entry according to the field of the file
+    template <Numeric T>
+    const char* parse_value(const char* p, const char* end, MarketField field, T& value) {
+        if (field == PATTERN) {
+            value = T(1);
+        } else if constexpr (is_complex_v<T>) {
+            typename T::value_type re{}, im{};
+            p = parse_number(p, end, re);
+            if (field == COMPLEX)
+                p = parse_number(p, end, im);
+            value = T(re, im);
+        } else if constexpr (std::is_integral_v<T>) {
+            if (field == INTEGER) {
+                p = parse_number(p, end, value);
+            } else {
+                double real_value;
+                p = parse_number(p, end, real_value);
+                value = static_cast<T>(real_value);
+            }
+        } else {
+            p = parse_number(p, end, value);
+        }
+        return p;
+    }
+
+    /**
+     * @brief Parse the banner and the size line of a Matrix Market file.
+     *
+     * Files without banner are read as "coordinate real general", as the old
+     * ifstream reader did.
+     */
+    inline MarketHeader read_header(std::string_view text) {
+        MarketHeader header;
+        std::size_t pos = 0;
+        auto next_line = [&]() {
+            std::size_t line_end = text.find('\n', pos);
+            if (line_end == std::string_view::npos)
+                line_end = text.size();
+            std::string_view line = text.substr(pos, line_end - pos);
+            pos = std::min(line_end + 1, text.size());
+            return line;
+        };
+
+        if (text.starts_with("%%MatrixMarket")) {
+            std::string banner(next_line());
+            std::transform(banner.begin(), banner.end(), banner.begin(), [](unsigned char c) { return std::tolower(c); });
+            std::istringstream iss(banner);
+            std::string tag, object, format, field, symmetry;
+            iss >> tag >> object >> format >> field >> symmetry;
+
+            if (object != "matrix" || format != "coordinate")
+                throw std::runtime_error("Only Matrix Market \"matrix coordinate\" files are supported, got: " + banner);
+
+            if (field == "real" || field == "double") header.field = REAL;
+            else if (field == "integer") header.field = INTEGER;
+            else if (field == "complex") header.field = COMPLEX;
+            else if (field == "pattern") header.field = PATTERN;
+            else throw std::runtime_error("Unknown Matrix Market field: " + field);
+
+            if (symmetry.empty() || symmetry == "general") header.symmetry = GENERAL;
+            else if (symmetry == "symmetric") header.symmetry = SYMMETRIC;
+            else if (symmetry == "skew-symmetric") header.symmetry = SKEW_SYMMETRIC;
+            else if (symmetry == "hermitian") header.symmetry = HERMITIAN;
+            else throw std::runtime_error("Unknown Matrix Market symmetry: " + symmetry);
+        }
+
+        // comments and blank lines before the size line
+        std::string_view line;
+        do {
+            if (pos >= text.size())
+                throw std::runtime_error("Matrix Market file without size line");
+            line = next_line();
+        } while (line.empty() || line.front() == '%' ||
+                 skip_blanks(line.data(), line.data() + line.size()) == line.data() + line.size());
+
+        const char* p = line.data();
+        const char* end = line.data() + line.size();
+        p = parse_number(p, end, header.rows);
+        p = parse_number(p, end, header.cols);
+        parse_number(p, end, header.num_entries);
+        header.data_begin = pos;
+        return header;
+    }
+
+    //! entries read by one thread, 0-based
+    template <Numeric T>
+    struct Triplets {
+        std::vector<std::size_t> rows, cols;
+        std::vector<T> values;
+    };
+
+    //! f(row, col, value), 0-based, for all the entry lines in [p, end), which must start at a line boundary
+    template <Numeric T, typename F>
+    void for_each_entry(const char* p, const char* end, const MarketHeader& header, F&& f) {
+        while (p < end) {
+            const char* line_end = std::find(p, end, '\n');
+            p = skip_blanks(p, line_end);
+            if (p != line_end && *p != '%') {
+                std::size_t row, col;
+                T value;
+                p = parse_number(p, line_end, row);
+                p = parse_number(p, line_end, col);
+                if (row == 0 || row > header.rows || col == 0 || col > header.cols)
+                    throw std::out_of_range("Matrix Market entry outside the matrix");
+                parse_value(p, line_end, header.field, value);
+                f(row - 1, col - 1, value);
+            }
+            p = line_end + 1;
+        }
+    }
+
+    //! parse all the entry lines in [p, end), which must start at a line boundary
+    template <Numeric T>
+    void parse_chunk(const char* p, const char* end, const MarketHeader& header, Triplets<T>& out) {
+        for_each_entry<T>(p, end, header, [&out](std::size_t row, std::size_t col, const T& value) {
+            out.rows.push_back(row);
+            out.cols.push_back(col);
+            out.values.push_back(value);
+        });
+    }
+
+    //! a_ji given a_ij of a symmetric, skew-symmetric or hermitian matrix
+    template <Numeric T>
+    T mirror_value(const T& value, MarketSymmetry symmetry) {
+        if (symmetry == SKEW_SYMMETRIC)
+            return -value;
+        if (symmetry == HERMITIAN)
+            return kernels::conj_if<true>(value);
+        return value;
+    }
+
+    //! split [begin, text.size()) in num_chunks ranges ending on a newline
+    inline std::vector<std::size_t> chunk_bounds(std::string_view text, std::size_t begin, std::size_t num_chunks) {
+        std::vector<std::size_t> bounds(num_chunks + 1, text.size());
+        bounds[0] = begin;
+        for (std::size_t t = 1; t < num_chunks; ++t) {
+            std::size_t guess = std::max(bounds[t - 1], begin + (text.size() - begin) * t / num_chunks);
+            std::size_t newline = text.find('\n', guess);
+            bounds[t] = newline == std::string_view::npos ? text.size() : newline + 1;
+        }
+        return bounds;
+    }
+
+    //! smallest chunk of the parallel parse, in bytes
+    inline constexpr std::size_t default_min_chunk = 1 << 20;
+
+    //! number of chunks of at least min_chunk bytes of the entry lines, at most max_chunks
+    inline std::size_t num_chunks_of(std::string_view text, const MarketHeader& header, std::size_t min_chunk,
+                                     std::size_t max_chunks) {
+        return std::max<std::size_t>(1, std::min(max_chunks, 1 + (text.size() - header.data_begin) / std::max<std::size_t>(min_chunk, 1)));
+    }
+
+    /**
+     * @brief Parse all the entries of the file, in line-aligned chunks of at
+     * least min_chunk bytes (one per hardware thread at most) parsed in
+     * parallel; the entries are returned as stored in the file (one triangle
+     * for symmetric files). The chunks only change how the work is split.
+     */
+    template <Numeric T>
+    std::vector<Triplets<T>> read_triplets(std::string_view text, const MarketHeader& header,
+                                           const std::string& file_name, std::size_t min_chunk = default_min_chunk,
+                                           std::size_t max_chunks = parallel::hardware_threads()) {
+        const std::size_t num_chunks = num_chunks_of(text, header, min_chunk, max_chunks);
+        const auto bounds = chunk_bounds(text, header.data_begin, num_chunks);
+
+        std::vector<Triplets<T>> chunks(num_chunks);
+        parallel::run(num_chunks, [&](std::size_t t) {
+            chunks[t].rows.reserve(header.num_entries / num_chunks + 1);
+            chunks[t].cols.reserve(header.num_entries / num_chunks + 1);
+            chunks[t].values.reserve(header.num_entries / num_chunks + 1);
+            parse_chunk(text.data() + bounds[t], text.data() + bounds[t + 1], header, chunks[t]);
+        });
+
+        std::size_t num_read = 0;
+        for (const auto& chunk : chunks)
+            num_read += chunk.values.size();
+        if (num_read != header.num_entries)
+            throw std::runtime_error("Matrix Market file " + file_name + " declares " + std::to_string(header.num_entries) +
+                                     " entries but contains " + std::to_string(num_read));
+        return chunks;
+    }
+
+    /**
+     * @brief Compressed lines from the entries of the chunks: a counting sort
+     * by line, then every line is sorted by inner index and a repeated entry
+     * keeps the last value. line_of(row, col) gives the (line, inner index) of
+     * an entry, the lines are [0, n_outer). The chunks are emptied.
+     *
+     * The consecutive chunks are scattered in groups, each with its own line
+     * offsets so that the file order is kept inside every line. There are at
+     * most entries / n_outer groups: the offsets never take more memory than
+     * the entries, however many threads parsed the file.
+     */
+    template <Numeric T, IndexType Index, typename LineOf>
+    void chunks_to_lines(std::vector<Triplets<T>>& chunks, std::size_t n_outer, LineOf line_of,
+                         std::vector<Index>& ptr, std::vector<Index>& idx, std::vector<T>& val) {
+        const std::size_t num_chunks = chunks.size();
+        std::size_t num_entries = 0;
+        for (const auto& chunk : chunks)
+            num_entries += chunk.values.size();
+        const std::size_t num_groups = std::clamp<std::size_t>(num_entries / std::max<std::size_t>(n_outer, 1), 1, std::max<std::size_t>(num_chunks, 1));
+        auto group_begin = [&](std::size_t g) { return g * num_chunks / num_groups; };
+
+        std::vector<std::vector<std::size_t>> offsets(num_groups, std::vector<std::size_t>(n_outer, 0));
+        parallel::run(num_groups, [&](std::size_t g) {
+            for (std::size_t t = group_begin(g); t < group_begin(g + 1); ++t)
+                for (std::size_t k = 0; k < chunks[t].values.size(); ++k)
+                    ++offsets[g][line_of(chunks[t].rows[k], chunks[t].cols[k]).first];
+        });
+        // the counts become the first position of every group in every line
+        ptr.assign(n_outer + 1, 0);
+        for (std::size_t i = 0; i < n_outer; ++i) {
+            std::size_t running = ptr[i];
+            for (std::size_t g = 0; g < num_groups; ++g) {
+                const std::size_t count = offsets[g][i];
+                offsets[g][i] = running;
+                running += count;
+            }
+            ptr[i + 1] = static_cast<Index>(running);
+        }
+
+        idx.resize(ptr[n_outer]);
+        val.resize(ptr[n_outer]);
+        parallel::run(num_groups, [&](std::size_t g) {
+            for (std::size_t t = group_begin(g); t < group_begin(g + 1); ++t) {
+                for (std::size_t k = 0; k < chunks[t].values.size(); ++k) {
+                    const auto [line, inner] = line_of(chunks[t].rows[k], chunks[t].cols[k]);
+                    const std::size_t dest = offsets[g][line]++;
+                    idx[dest] = static_cast<Index>(inner);
+                    val[dest] = chunks[t].values[k];
+                }
+                chunks[t] = Triplets<T>();
+            }
+        });
+        chunks.clear();
+        offsets.clear();
+
+        // sort every line by inner index (stable: entries keep the file order),
+        // repeated entries (rare) keep the last value
+        const auto line_bounds = kernels::balanced_partition<Index>(ptr, num_chunks);
+        std::vector<std::size_t> duplicates(num_chunks, 0);
+        parallel::run(num_chunks, [&](std::size_t t) {
+            duplicates[t] = kernels::sort_lines<T, Index>(ptr, idx, val, line_bounds[t], line_bounds[t + 1]);
+        });
+        if (std::any_of(duplicates.begin(), duplicates.end(), [](std::size_t d) { return d != 0; }))
+            kernels::combine_duplicates(ptr, idx, val, [](const T&, const T& last) { return last; });
+    }
+
+}  // namespace market
+
 /**
  * @brief Read a matrix in the matrix-market format.
  *
+ * The file is memory mapped and split in line-aligned chunks parsed in
+ * parallel with std::from_chars. The entries are scattered directly into the
+ * compressed arrays of the storage order of the matrix with a counting sort,
+ * every line is then sorted by inner index (a repeated entry keeps the last
+ * value, as the map did). The field of the banner (real, integer, complex,
+ * pattern) decides how values are parsed. For symmetric, skew-symmetric and
+ * hermitian files the entries implied by the stored triangle are added, so
+ * that the matrix is the full one (SymmetricMatrix keeps one triangle).
+ *
  * @tparam T Type of the matrix entries.
- * @tparam Store StorageOrder for the matrix, deciding the ordering of the
- * mapping.
+ * @tparam order StorageOrder for the matrix.
+ * @tparam Index Type of the compressed indices, the size line is checked
+ * against its range.
  * @param file_name Path to the matrix-market file.
- * @return std::map<std::array<std::size_t, 2>, T,
- * std::conditional_t<Store == StorageOrder::row, RowOrderComparator<T>,
- * ColOrderComparator<T>>> Mapping "(row, col) -> value" which can be directly
- * passed into the constructor.
+ * @param read_compressed If true the matrix is left in compressed format,
+ * otherwise it is uncompressed into the map as before.
  */
-template<Numeric T, StorageOrder order>
-Matrix<T, order>::Matrix(const std::string& file_name) {
-  using MapType = std::map<Key, T,  Compare<T, order>>;
+template<Numeric T, StorageOrder order, IndexType Index, typename Allocator>
+Matrix<T, order, Index, Allocator>::Matrix(const std::string& file_name, bool read_compressed) {
+  ALGEBRA_PERF_REGION("read");
+  MappedFile file(file_name);
+  const std::string_view text = file.view();
+  const MarketHeader header = market::read_header(text);
 
-  std::ifstream file(file_name);
-  if (!file.is_open()) {
-    throw std::runtime_error("Failed to open file: " + file_name);
+  check_index_range(header.rows, header.cols, header.num_entries);
+  if constexpr (!is_complex_v<T>) {
+    if (header.field == COMPLEX)
+      throw std::runtime_error("Cannot read a complex Matrix Market file into a real matrix: " + file_name);
   }
 
-  std::string line;
+  std::vector<market::Triplets<T>> chunks = market::read_triplets<T>(text, header, file_name);
+  const std::size_t num_chunks = chunks.size();
 
-  while (file.peek() == '%') {
-    file.ignore(2048, '\n');
+  // the other triangle of symmetric files
+  if (header.symmetry != GENERAL) {
+    parallel::run(num_chunks, [&](std::size_t t) {
+      auto& c = chunks[t];
+      const std::size_t stored = c.values.size();
+      for (std::size_t k = 0; k < stored; ++k) {
+        if (c.rows[k] != c.cols[k]) {
+          c.rows.push_back(c.cols[k]);
+          c.cols.push_back(c.rows[k]);
+          c.values.push_back(market::mirror_value(c.values[k], header.symmetry));
+        }
+      }
+    });
   }
-  // std::istringstream iss(line);
-  std::size_t num_rows, num_cols, num_elements;
-
-  file >> num_rows >> num_cols >> num_elements;
+  std::size_t num_read = 0;
+  for (const auto& chunk : chunks)
+    num_read += chunk.values.size();
+  check_index_range(header.rows, header.cols, num_read);
 
-  MapType entry_value_map;
+  rows = header.rows;
+  cols = header.cols;
+  const std::size_t n_outer = order == ROW_MAJOR ? rows : cols;
+  std::vector<Index> ptr, idx;
+  std::vector<T> val;
+  market::chunks_to_lines<T, Index>(chunks, n_outer, [](std::size_t row, std::size_t col) {
+    return order == ROW_MAJOR ? std::pair{row, col} : std::pair{col, row};
+  }, ptr, idx, val);
 
-  for (std::size_t i = 0; i < num_elements; ++i) {
-    std::size_t row, col;
-    T value;
-    file >> row >> col >> value;
-
-    // we always use the format (row, col) -> value
-    // only the comparison operator is different
-    entry_value_map[{row - 1, col - 1}] = value;
+  values = std::move(val);
+  if constexpr (order == ROW_MAJOR) {
+    row_indices = std::move(ptr);
+    col_indices = std::move(idx);
+  } else {
+    col_indices = std::move(ptr);
+    row_indices = std::move(idx);
   }
-  //finally we delegate the constructor
-  data = entry_value_map;
-  rows = num_rows;
-  cols = num_cols;
-  compressed = false;
+  compressed = true;
+  update_line_bounds();
+
+  if (!read_compressed)
+    uncompress();
 }
 }  // namespace algebra
 
@@ -0,0 +1,151 @@
+#ifndef MIXED_MATRIX_HPP
+#define MIXED_MATRIX_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "Matrix.hpp"
+#include "Parallel.hpp"
+#include "SparseKernels.hpp"
+#include "Utils.hpp"
+
+namespace algebra {
+
+/**
+ * @brief Compressed row (CSR) matrix storing its values in a narrow type S
+ * and computing in a wider accumulation type A.
+ *
+ * The product is bound by the memory traffic of the values: float values
+ * with double accumulation read half the bytes of a Matrix<double>, 16-bit
+ * values (bfloat16, float16) a quarter. The vectors, the sums of the product
+ * and of the norms are in A, so the only error added is the rounding of every
+ * value to S once, when the matrix is built. The solvers accept a MixedMatrix
+ * in place of a Matrix: the Krylov vectors and residuals stay in A.
+ *
+ * @tparam S Type of the stored values.
+ * @tparam A Type of the vectors and of the accumulation.
+ * @tparam Index Type of the indices.
+ */
+template <StorageType S, Numeric A = accumulator_t<S>, IndexType Index = std::size_t>
+class MixedMatrix {
+public:
+    MixedMatrix() = default;
+
+    // build from a Matrix in any StorageOrder, compressed or not (a map or
+    // COL_MAJOR matrix goes through a compressed ROW_MAJOR copy); every value
+    // is rounded to S
+    template <StorageOrder order>
+    explicit MixedMatrix(const Matrix<A, order, Index>& m) {
+        if constexpr (order == ROW_MAJOR) {
+            if (m.is_fully_compressed()) {
+                build(m);
+            } else {
+                Matrix<A, ROW_MAJOR, Index> m_compressed = m;
+                m_compressed.compress();
+                build(m_compressed);
+            }
+        } else {
+            Matrix<A, COL_MAJOR, Index> m_compressed = m;
+            m_compressed.compress();
+            build(m_compressed.template convert<ROW_MAJOR>());
+        }
+    }
+
+    std::size_t get_rows() const { return rows; }
+    std::size_t get_cols() const { return cols; }
+    std::size_t get_num_non_zero() const { return values.size(); }
+
+    const std::vector<S>& get_values() const { return values; }
+    const std::vector<Index>& get_row_indices() const { return row_indices; }
+    const std::vector<Index>& get_col_indices() const { return col_indices; }
+
+    void set_num_threads(std::size_t n) { num_threads = n == 0 ? parallel::hardware_threads() : n; }
+    std::size_t get_num_threads() const { return num_threads; }
+
+    // element access, binary search of the column in the row
+    A operator()(std::size_t row, std::size_t col) const {
+        if (row >= rows || col >= cols)
+            throw std::out_of_range("Index out of range");
+        const std::size_t pos = kernels::find_in_line<Index>(col_indices, row_indices[row], row_indices[row + 1], col);
+        return pos == row_indices[row + 1] ? A(0) : static_cast<A>(values[pos]);
+    }
+
+    // y = alpha * A x + beta * y, as Matrix::multiply
+    void multiply(std::span<const A> x, std::span<A> y, A alpha = A(1), A beta = A(0)) const {
+        if (x.size() < cols || y.size() < rows)
+            throw std::invalid_argument("Vector sizes do not match the matrix dimensions");
+        ALGEBRA_PERF_REGION("spmv_mixed");
+        const auto bounds = kernels::balanced_partition<Index>(row_indices, num_threads);
+        parallel::run(num_threads, [&](std::size_t t) {
+            kernels::spmv_gather_scaled<A, Index, S>(row_indices, col_indices, values, x, y, alpha, beta,
+                                                     bounds[t], bounds[t + 1]);
+        });
+    }
+
+    template <WhichNorm NORM>
+    A norm() const;
+
+    friend std::vector<A> operator*(const MixedMatrix& m, const std::vector<A>& v) {
+        if (v.size() != m.cols)
+            throw std::invalid_argument("Matrix and vector dimensions do not match for multiplication");
+        std::vector<A> out(m.rows);
+        m.multiply(v, out);
+        return out;
+    }
+
+private:
+    void build(const Matrix<A, ROW_MAJOR, Index>& m) {
+        rows = m.get_rows();
+        cols = m.get_cols();
+        num_threads = m.get_num_threads();
+        row_indices = m.get_row_indices();
+        col_indices = m.get_col_indices();
+        const auto& wide = m.get_values();
+        values.resize(wide.size());
+        std::transform(wide.begin(), wide.end(), values.begin(), [](const A& v) { return static_cast<S>(v); });
+    }
+
+    std::size_t rows = 0, cols = 0;
+    std::size_t num_threads = 1;
+    std::vector<Index> row_indices;  // rows + 1 entries
+    std::vector<Index> col_indices;
+    std::vector<S> values;
+};
+
+// FROBENIUS sums the squares in double as Matrix::norm does, the others sum
+// in the real type of A: ONE the columns with a serial scatter, MAX the rows
+// in parallel
+template <StorageType S, Numeric A, IndexType Index>
+template <WhichNorm NORM>
+A MixedMatrix<S, A, Index>::norm() const {
+    using Real = real_type_t<A>;
+    auto magnitude = [](const S& v) { return static_cast<Real>(std::abs(static_cast<A>(v))); };
+    if constexpr (NORM == WhichNorm::FROBENIUS) {
+        return A(std::sqrt(std::accumulate(values.begin(), values.end(), 0.0,
+            [](double acc, const S& value) {
+                return acc + std::norm(static_cast<A>(value));
+            })));
+    } else if constexpr (NORM == WhichNorm::ONE) {
+        std::vector<Real> sum_col(cols, Real(0));
+        for (std::size_t k = 0; k < values.size(); ++k)
+            sum_col[col_indices[k]] += magnitude(values[k]);
+        return sum_col.empty() ? A(0) : A(*std::max_element(sum_col.begin(), sum_col.end()));
+    } else {
+        std::vector<Real> sum_row(rows, Real(0));
+        const auto bounds = kernels::balanced_partition<Index>(row_indices, num_threads);
+        parallel::run(num_threads, [&](std::size_t t) {
+            for (std::size_t i = bounds[t]; i < bounds[t + 1]; ++i)
+                for (std::size_t k = row_indices[i]; k < row_indices[i + 1]; ++k)
+                    sum_row[i] += magnitude(values[k]);
+        });
+        return sum_row.empty() ? A(0) : A(*std::max_element(sum_row.begin(), sum_row.end()));
+    }
+}
+
+}  // namespace algebra
+
+#endif
@@ -0,0 +1,446 @@
+#ifndef OUT_OF_CORE_MATRIX_HPP
+#define OUT_OF_CORE_MATRIX_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "MappedFile.hpp"
+#include "MatrixBinaryIO.hpp"
+#include "MatrixFileConstructor.hpp"
+#include "Parallel.hpp"
+#include "PerfCounters.hpp"
+#include "SparseKernels.hpp"
+#include "Utils.hpp"
+
+namespace algebra {
+
+namespace out_of_core {
+
+    inline constexpr char magic[8] = {'S', 'P', 'M', 'A', 'T', 'O', 'O', 'C'};
+    inline constexpr std::uint32_t version = 1;
+
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byte_order;
+        std::uint32_t value_type;   // binary::type_code
+        std::uint32_t index_width;  // bytes of an index
+        std::uint64_t rows, cols, nnz;
+        std::uint64_t num_panels, panels_offset;
+    };
+    static_assert(sizeof(Header) == 64);
+
+    //! rows [row_begin, row_end) stored at offset (a multiple of binary::alignment)
+    struct Panel {
+        std::uint64_t row_begin, row_end, nnz, offset;
+    };
+
+    //! pread until all the bytes are read
+    inline void read_fully(int fd, void* data, std::size_t bytes, std::uint64_t offset) {
+        char* out = static_cast<char*>(data);
+        while (bytes > 0) {
+            const ssize_t n = ::pread(fd, out, bytes, static_cast<off_t>(offset));
+            if (n <= 0)
+                throw std::runtime_error("Failed to read panel file");
+            out += n;
+            bytes -= static_cast<std::size_t>(n);
+            offset += static_cast<std::uint64_t>(n);
+        }
+    }
+
+}  // namespace out_of_core
+
+/**
+ * @brief Compressed row matrix kept on disk in row panels, for matrices larger
+ * than the memory.
+ *
+ * convert() turns a Matrix Market file into a panel file: consecutive rows are
+ * grouped in panels, every panel is a small CSR matrix (local row pointers,
+ * global column indices, values) aligned to binary::alignment, and a table at
+ * the end of the file gives the rows and offset of every panel. Panels are
+ * cut so that two of them fit in the memory budget.
+ *
+ * The product streams the panels through two buffers: while the threads
+ * multiply the panel in one buffer, the next panel is read (pread, on an
+ * asynchronous task) into the other, so the disk and the cores work at the
+ * same time. The matrix itself never takes more than the budget; x and y are
+ * in memory. Every row is summed as by Matrix::multiply, so the result is
+ * identical to the product of the in-memory CSR matrix read from the same file.
+ *
+ * @tparam T Type of the values.
+ * @tparam Index Type of the indices stored in the panels.
+ */
+template <Numeric T, IndexType Index = std::size_t>
+class OutOfCoreMatrix {
+public:
+    /**
+     * @brief Write the panel file of a Matrix Market file and open it.
+     *
+     * The file is read twice (mapped, in parallel chunks): once to count the
+     * entries of every row and cut the panels, then once per group of panels,
+     * holding only the entries of the group. Symmetric files are expanded,
+     * and repeated entries keep the last value, as in the Matrix constructor.
+     *
+     * @param memory_budget Bytes for the matrix: two panel buffers in the
+     * product, the entries of a group during the conversion. Per row vectors
+     * (one shared entry count per row, x and y) are not counted.
+     */
+    static OutOfCoreMatrix convert(const std::string& market_file, const std::string& panel_file,
+                                   std::size_t memory_budget);
+
+    // open a panel file written by convert
+    explicit OutOfCoreMatrix(const std::string& panel_file) : file_name(panel_file) {
+        fd = ::open(panel_file.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Failed to open file: " + panel_file);
+        try {
+            read_table();
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        // the panels are read front to back by every product
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    OutOfCoreMatrix(const OutOfCoreMatrix&) = delete;
+    OutOfCoreMatrix& operator=(const OutOfCoreMatrix&) = delete;
+
+    OutOfCoreMatrix(OutOfCoreMatrix&& other) noexcept
+        : file_name(std::move(other.file_name)), fd(std::exchange(other.fd, -1)), header(other.header),
+          panels(std::move(other.panels)), max_panel_bytes(other.max_panel_bytes), num_threads(other.num_threads) {}
+
+    OutOfCoreMatrix& operator=(OutOfCoreMatrix&& other) noexcept {
+        if (this != &other) {
+            close();
+            file_name = std::move(other.file_name);
+            fd = std::exchange(other.fd, -1);
+            header = other.header;
+            panels = std::move(other.panels);
+            max_panel_bytes = other.max_panel_bytes;
+            num_threads = other.num_threads;
+        }
+        return *this;
+    }
+
+    ~OutOfCoreMatrix() { close(); }
+
+    std::size_t get_rows() const { return header.rows; }
+    std::size_t get_cols() const { return header.cols; }
+    std::size_t get_num_non_zero() const { return header.nnz; }
+    std::size_t get_num_panels() const { return panels.size(); }
+    // size of the largest panel, the product holds two
+    std::size_t get_max_panel_bytes() const { return max_panel_bytes; }
+
+    void set_num_threads(std::size_t n) { num_threads = n == 0 ? parallel::hardware_threads() : n; }
+    std::size_t get_num_threads() const { return num_threads; }
+
+    // y = alpha * A x + beta * y, as Matrix::multiply
+    void multiply(std::span<const T> x, std::span<T> y, T alpha = T(1), T beta = T(0)) const;
+
+    friend std::vector<T> operator*(const OutOfCoreMatrix& m, const std::vector<T>& v) {
+        if (v.size() != m.get_cols())
+            throw std::invalid_argument("Matrix and vector dimensions do not match for multiplication");
+        std::vector<T> out(m.get_rows());
+        m.multiply(v, out);
+        return out;
+    }
+
+private:
+    // offsets in a panel of n_rows rows: row pointers at 0, then the column
+    // indices and the values, each aligned
+    struct PanelLayout {
+        std::uint64_t idx_offset, values_offset, bytes;
+    };
+
+    static PanelLayout layout(std::size_t n_rows, std::size_t nnz) {
+        PanelLayout l;
+        l.idx_offset = binary::align_up((n_rows + 1) * sizeof(Index));
+        l.values_offset = binary::align_up(l.idx_offset + nnz * sizeof(Index));
+        l.bytes = l.values_offset + nnz * sizeof(T);
+        return l;
+    }
+
+    void read_table() {
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+            throw std::runtime_error("Failed to stat file: " + file_name);
+        const auto file_size = static_cast<std::uint64_t>(st.st_size);
+        if (file_size < sizeof(header))
+            throw std::runtime_error("Not a panel file: " + file_name);
+        out_of_core::read_fully(fd, &header, sizeof(header), 0);
+        if (std::memcmp(header.magic, out_of_core::magic, sizeof(out_of_core::magic)) != 0)
+            throw std::runtime_error("Not a panel file: " + file_name);
+        if (header.version != out_of_core::version)
+            throw std::runtime_error("Unsupported panel file version " + std::to_string(header.version) + " in " + file_name);
+        if (header.byte_order != binary::byte_order_mark)
+            throw std::runtime_error("Panel file written with a different byte order: " + file_name);
+        if (header.value_type != binary::type_code<T>())
+            throw std::runtime_error("Panel file " + file_name + " stores a different value type");
+        if (header.index_width != sizeof(Index))
+            throw std::runtime_error("Panel file " + file_name + " stores a different index width");
+        constexpr std::uint64_t max_index = std::numeric_limits<Index>::max();
+        if (header.rows >= max_index || header.cols >= max_index || header.nnz > max_index)
+            throw std::runtime_error("Panel file " + file_name + " does not fit the index type");
+        if (!binary::fits(header.panels_offset, header.num_panels, sizeof(out_of_core::Panel), file_size))
+            throw std::runtime_error("Truncated panel file: " + file_name);
+
+        // the panels must cover the rows in order, each one aligned inside the file
+        panels.resize(header.num_panels);
+        out_of_core::read_fully(fd, panels.data(), panels.size() * sizeof(out_of_core::Panel), header.panels_offset);
+        max_panel_bytes = 0;
+        std::uint64_t next_row = 0, total_nnz = 0;
+        for (const auto& panel : panels) {
+            if (panel.row_begin != next_row || panel.row_end < panel.row_begin || panel.row_end > header.rows ||
+                panel.nnz > header.nnz - total_nnz || panel.offset % binary::alignment != 0)
+                throw std::runtime_error("Corrupt panel table in panel file: " + file_name);
+            next_row = panel.row_end;
+            total_nnz += panel.nnz;
+            const std::uint64_t bytes = layout(panel.row_end - panel.row_begin, panel.nnz).bytes;
+            if (!binary::fits(panel.offset, bytes, 1, file_size))
+                throw std::runtime_error("Truncated panel file: " + file_name);
+            max_panel_bytes = std::max<std::size_t>(max_panel_bytes, bytes);
+        }
+        if (next_row != header.rows || total_nnz != header.nnz)
+            throw std::runtime_error("Corrupt panel table in panel file: " + file_name);
+    }
+
+    void close() {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    std::string file_name;
+    int fd = -1;
+    out_of_core::Header header{};
+    std::vector<out_of_core::Panel> panels;
+    std::size_t max_panel_bytes = 0;
+    std::size_t num_threads = 1;
+};
+
+template <Numeric T, IndexType Index>
+OutOfCoreMatrix<T, Index> OutOfCoreMatrix<T, Index>::convert(const std::string& market_file,
+                                                             const std::string& panel_file,
+                                                             std::size_t memory_budget) {
+    ALGEBRA_PERF_REGION("convert_out_of_core");
+    MappedFile file(market_file);
+    const std::string_view text = file.view();
+    const MarketHeader header = market::read_header(text);
+    if constexpr (!is_complex_v<T>) {
+        if (header.field == COMPLEX)
+            throw std::runtime_error("Cannot read a complex Matrix Market file into a real matrix: " + market_file);
+    }
+    constexpr std::size_t max_index = std::numeric_limits<Index>::max();
+    if (header.rows >= max_index || header.cols >= max_index)
+        throw std::overflow_error("Matrix too large for the chosen index type: " + std::to_string(header.rows) + "x" +
+                                  std::to_string(header.cols));
+
+    // chunks as in market::read_triplets, so that repeated entries resolve the same way
+    const std::size_t num_chunks = market::num_chunks_of(text, header, market::default_min_chunk, parallel::hardware_threads());
+    const auto chunk_bounds = market::chunk_bounds(text, header.data_begin, num_chunks);
+    const bool mirrored = header.symmetry != GENERAL;
+
+    // first pass: entries of every row, with the other triangle of symmetric
+    // files, counted by all the threads in one shared array
+    std::vector<std::size_t> row_count(header.rows, 0);
+    std::vector<std::size_t> num_read(num_chunks, 0);
+    parallel::run(num_chunks, [&](std::size_t t) {
+        market::for_each_entry<T>(text.data() + chunk_bounds[t], text.data() + chunk_bounds[t + 1], header,
+                                  [&](std::size_t row, std::size_t col, const T&) {
+            ++num_read[t];
+            std::atomic_ref<std::size_t>(row_count[row]).fetch_add(1, std::memory_order_relaxed);
+            if (mirrored && row != col)
+                std::atomic_ref<std::size_t>(row_count[col]).fetch_add(1, std::memory_order_relaxed);
+        });
+    });
+    std::size_t total_read = 0;
+    for (std::size_t n : num_read)
+        total_read += n;
+    if (total_read != header.num_entries)
+        throw std::runtime_error("Matrix Market file " + market_file + " declares " + std::to_string(header.num_entries) +
+                                 " entries but contains " + std::to_string(total_read));
+
+    // panels: consecutive rows while the panel takes at most half the budget,
+    // and its entries fit in the budget while converted (as triplets and as
+    // compressed arrays). Repeated entries are counted, so panels are upper
+    // bounds of the final ones.
+    constexpr std::size_t entry_bytes = 2 * sizeof(std::size_t) + 2 * sizeof(T) + sizeof(Index);
+    const std::size_t max_entries = memory_budget / entry_bytes;
+    auto fits = [&](std::size_t n_rows, std::size_t nnz) {
+        return nnz <= max_entries && nnz < max_index && 2 * layout(n_rows, nnz).bytes <= memory_budget;
+    };
+    std::vector<std::size_t> panel_rows{0};  // panel p is [panel_rows[p], panel_rows[p + 1])
+    std::vector<std::size_t> panel_nnz;
+    std::size_t nnz = 0;
+    for (std::size_t i = 0; i < header.rows; ++i) {
+        if (!fits(1, row_count[i]))
+            throw std::invalid_argument("Memory budget of " + std::to_string(memory_budget) + " bytes too small for row " +
+                                        std::to_string(i) + " with " + std::to_string(row_count[i]) + " entries");
+        if (!fits(i + 1 - panel_rows.back(), nnz + row_count[i])) {
+            panel_rows.push_back(i);
+            panel_nnz.push_back(nnz);
+            nnz = 0;
+        }
+        nnz += row_count[i];
+    }
+    if (header.rows > 0) {
+        panel_rows.push_back(header.rows);
+        panel_nnz.push_back(nnz);
+    }
+    const std::size_t num_panels = panel_nnz.size();
+
+    std::ofstream out(panel_file, std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+        throw std::runtime_error("Failed to open file: " + panel_file);
+    const char zeros[binary::alignment] = {};
+    auto write_at = [&](std::uint64_t offset, const void* data, std::size_t bytes) {
+        const auto pos = static_cast<std::uint64_t>(out.tellp());
+        out.write(zeros, static_cast<std::streamsize>(offset - pos));
+        out.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+    };
+    out_of_core::Header file_header{};
+    out.write(reinterpret_cast<const char*>(&file_header), sizeof(file_header));  // rewritten at the end
+
+    // second pass per group of panels whose entries fit in the budget together
+    std::vector<out_of_core::Panel> table;
+    table.reserve(num_panels);
+    std::size_t total_nnz = 0;
+    for (std::size_t group_begin = 0; group_begin < num_panels;) {
+        std::size_t group_end = group_begin + 1, group_nnz = panel_nnz[group_begin];
+        while (group_end < num_panels && group_nnz + panel_nnz[group_end] <= max_entries)
+            group_nnz += panel_nnz[group_end++];
+        const std::size_t row_begin = panel_rows[group_begin], row_end = panel_rows[group_end];
+
+        // entries of the group rows; mirrored entries follow the stored ones
+        // of their chunk, as in the Matrix constructor
+        std::vector<market::Triplets<T>> chunks(num_chunks);
+        parallel::run(num_chunks, [&](std::size_t t) {
+            market::Triplets<T> mirror;
+            market::for_each_entry<T>(text.data() + chunk_bounds[t], text.data() + chunk_bounds[t + 1], header,
+                                      [&](std::size_t row, std::size_t col, const T& value) {
+                if (row >= row_begin && row < row_end) {
+                    chunks[t].rows.push_back(row);
+                    chunks[t].cols.push_back(col);
+                    chunks[t].values.push_back(value);
+                }
+                if (mirrored && row != col && col >= row_begin && col < row_end) {
+                    mirror.rows.push_back(col);
+                    mirror.cols.push_back(row);
+                    mirror.values.push_back(market::mirror_value(value, header.symmetry));
+                }
+            });
+            chunks[t].rows.insert(chunks[t].rows.end(), mirror.rows.begin(), mirror.rows.end());
+            chunks[t].cols.insert(chunks[t].cols.end(), mirror.cols.begin(), mirror.cols.end());
+            chunks[t].values.insert(chunks[t].values.end(), mirror.values.begin(), mirror.values.end());
+        });
+        std::vector<Index> ptr, idx;
+        std::vector<T> val;
+        market::chunks_to_lines<T, Index>(chunks, row_end - row_begin, [row_begin](std::size_t row, std::size_t col) {
+            return std::pair{row - row_begin, col};
+        }, ptr, idx, val);
+
+        for (std::size_t p = group_begin; p < group_end; ++p) {
+            const std::size_t first = panel_rows[p] - row_begin, last = panel_rows[p + 1] - row_begin;
+            const std::size_t n_rows = last - first;
+            std::vector<Index> local_ptr(n_rows + 1);
+            for (std::size_t i = 0; i <= n_rows; ++i)
+                local_ptr[i] = ptr[first + i] - ptr[first];
+            const std::size_t n = local_ptr[n_rows];
+            const PanelLayout l = layout(n_rows, n);
+            const std::uint64_t offset = binary::align_up(static_cast<std::uint64_t>(out.tellp()));
+            write_at(offset, local_ptr.data(), local_ptr.size() * sizeof(Index));
+            write_at(offset + l.idx_offset, idx.data() + ptr[first], n * sizeof(Index));
+            write_at(offset + l.values_offset, val.data() + ptr[first], n * sizeof(T));
+            table.push_back({panel_rows[p], panel_rows[p + 1], n, offset});
+            total_nnz += n;
+        }
+        group_begin = group_end;
+    }
+
+    std::memcpy(file_header.magic, out_of_core::magic, sizeof(out_of_core::magic));
+    file_header.version = out_of_core::version;
+    file_header.byte_order = binary::byte_order_mark;
+    file_header.value_type = binary::type_code<T>();
+    file_header.index_width = sizeof(Index);
+    file_header.rows = header.rows;
+    file_header.cols = header.cols;
+    file_header.nnz = total_nnz;
+    file_header.num_panels = table.size();
+    file_header.panels_offset = binary::align_up(static_cast<std::uint64_t>(out.tellp()));
+    write_at(file_header.panels_offset, table.data(), table.size() * sizeof(out_of_core::Panel));
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&file_header), sizeof(file_header));
+    out.close();
+    if (!out)
+        throw std::runtime_error("Failed to write file: " + panel_file);
+    return OutOfCoreMatrix(panel_file);
+}
+
+template <Numeric T, IndexType Index>
+void OutOfCoreMatrix<T, Index>::multiply(std::span<const T> x, std::span<T> y, T alpha, T beta) const {
+    if (x.size() < get_cols() || y.size() < get_rows())
+        throw std::invalid_argument("Vector sizes do not match the matrix dimensions");
+    if (panels.empty())
+        return;
+    ALGEBRA_PERF_REGION("spmv_out_of_core");
+
+    // double buffering: panel p is in buffers[p % 2] while p + 1 is read into the other
+    const std::size_t words = (max_panel_bytes + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
+    std::array<std::vector<std::max_align_t>, 2> buffers{std::vector<std::max_align_t>(words),
+                                                         std::vector<std::max_align_t>(words)};
+    // a panel is checked as it is read, on the reading task, so that a
+    // corrupt file cannot make the product read outside the panel or x
+    auto load = [this, &buffers](std::size_t p) {
+        const auto& panel = panels[p];
+        const std::size_t n_rows = panel.row_end - panel.row_begin;
+        const PanelLayout l = layout(n_rows, panel.nnz);
+        const char* base = reinterpret_cast<const char*>(buffers[p % 2].data());
+        out_of_core::read_fully(fd, buffers[p % 2].data(), l.bytes, panel.offset);
+        binary::check_arrays<Index>(std::span<const Index>(reinterpret_cast<const Index*>(base), n_rows + 1),
+                                    std::span<const Index>(reinterpret_cast<const Index*>(base + l.idx_offset), panel.nnz),
+                                    header.cols, file_name);
+    };
+
+    std::future<void> next = std::async(std::launch::async, load, 0);
+    for (std::size_t p = 0; p < panels.size(); ++p) {
+        next.get();
+        if (p + 1 < panels.size())
+            next = std::async(std::launch::async, load, p + 1);
+
+        const auto& panel = panels[p];
+        const std::size_t n_rows = panel.row_end - panel.row_begin;
+        const PanelLayout l = layout(n_rows, panel.nnz);
+        const char* base = reinterpret_cast<const char*>(buffers[p % 2].data());
+        std::span<const Index> ptr(reinterpret_cast<const Index*>(base), n_rows + 1);
+        std::span<const Index> idx(reinterpret_cast<const Index*>(base + l.idx_offset), panel.nnz);
+        std::span<const T> val(reinterpret_cast<const T*>(base + l.values_offset), panel.nnz);
+        std::span<T> y_panel = y.subspan(panel.row_begin, n_rows);
+
+        const auto bounds = kernels::balanced_partition<Index>(ptr, num_threads);
+        parallel::run(num_threads, [&](std::size_t t) {
+            kernels::spmv_gather_scaled<T, Index>(ptr, idx, val, x, y_panel, alpha, beta, bounds[t], bounds[t + 1]);
+        });
+    }
+}
+
+}  // namespace algebra
+
+#endif
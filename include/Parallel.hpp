@@ -0,0 +1,194 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "PerfCounters.hpp"
+
+namespace algebra {
+namespace parallel {
+
+    //! Number of hardware threads (at least 1)
+    inline std::size_t hardware_threads() {
+        const unsigned int n = std::thread::hardware_concurrency();
+        return n == 0 ? 1 : n;
+    }
+
+    namespace detail {
+
+        //! true on the pool workers, and on a thread while it runs tasks on the pool
+        inline thread_local bool inside_pool = false;
+
+        //! f(t) on new threads for t in [1, num_threads), f(0) on the calling one
+        template <typename F>
+        void spawn(std::size_t num_threads, F& f, const char* region) {
+            std::vector<std::thread> threads;
+            threads.reserve(num_threads - 1);
+            std::exception_ptr error;
+            std::mutex error_mutex;
+            for (std::size_t t = 1; t < num_threads; ++t)
+                threads.emplace_back([&f, &error, &error_mutex, t, region]() {
+                    try {
+                        perf::WorkerRegion worker(region, t);
+                        f(t);
+                    } catch (...) {
+                        std::lock_guard lock(error_mutex);
+                        if (!error)
+                            error = std::current_exception();
+                    }
+                });
+            try {
+                f(std::size_t{0});
+            } catch (...) {
+                std::lock_guard lock(error_mutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+            for (auto& thread : threads)
+                thread.join();
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+        /**
+         * @brief Threads started once and kept for the whole program.
+         *
+         * Worker w runs task w of every run that has more than w tasks, the
+         * caller runs task 0. The pool grows to the largest number of tasks
+         * asked for. One run at a time: a run asked for while the pool is busy
+         * (from a task, or from another thread) reports it and the caller
+         * starts threads of its own.
+         */
+        class ThreadPool {
+        public:
+            static ThreadPool& instance() {
+                static ThreadPool pool;
+                return pool;
+            }
+
+            ThreadPool(const ThreadPool&) = delete;
+            ThreadPool& operator=(const ThreadPool&) = delete;
+
+            ~ThreadPool() {
+                {
+                    std::lock_guard lock(mutex);
+                    stopping = true;
+                }
+                work.notify_all();
+                for (auto& worker : workers)
+                    worker.join();
+            }
+
+            //! f(t) for t in [0, num_threads), false (nothing run) if the pool is busy
+            template <typename F>
+            bool try_run(std::size_t num_threads, F& f, const char* region) {
+                std::unique_lock busy(in_use, std::try_to_lock);
+                if (!busy.owns_lock())
+                    return false;
+                inside_pool = true;
+                {
+                    std::lock_guard lock(mutex);
+                    while (workers.size() + 1 < num_threads)
+                        workers.emplace_back([this, w = workers.size() + 1]() { work_loop(w); });
+                    task = [](void* context, std::size_t t) { (*static_cast<F*>(context))(t); };
+                    task_context = const_cast<void*>(static_cast<const void*>(&f));
+                    task_region = region;
+                    num_tasks = num_threads;
+                    remaining = num_threads - 1;
+                    error = nullptr;
+                    ++generation;
+                }
+                work.notify_all();
+
+                std::exception_ptr caller_error;
+                try {
+                    f(std::size_t{0});
+                } catch (...) {
+                    caller_error = std::current_exception();
+                }
+                std::unique_lock lock(mutex);
+                done.wait(lock, [this]() { return remaining == 0; });
+                inside_pool = false;
+                if (!caller_error)
+                    caller_error = error;
+                lock.unlock();
+                if (caller_error)
+                    std::rethrow_exception(caller_error);
+                return true;
+            }
+
+        private:
+            ThreadPool() = default;
+
+            void work_loop(std::size_t w) {
+                inside_pool = true;
+                std::size_t seen = 0;
+                std::unique_lock lock(mutex);
+                while (true) {
+                    work.wait(lock, [&]() { return stopping || generation != seen; });
+                    if (stopping)
+                        return;
+                    seen = generation;
+                    if (w >= num_tasks)
+                        continue;
+                    lock.unlock();
+                    std::exception_ptr task_error;
+                    try {
+                        perf::WorkerRegion worker(task_region, w);
+                        task(task_context, w);
+                    } catch (...) {
+                        task_error = std::current_exception();
+                    }
+                    lock.lock();
+                    if (task_error && !error)
+                        error = task_error;
+                    if (--remaining == 0)
+                        done.notify_one();
+                }
+            }
+
+            std::mutex in_use;  // held by the caller for a whole run
+            std::mutex mutex;   // guards everything below
+            std::condition_variable work, done;
+            std::vector<std::thread> workers;  // worker w is workers[w - 1]
+            void (*task)(void*, std::size_t) = nullptr;
+            void* task_context = nullptr;
+            const char* task_region = nullptr;
+            std::size_t num_tasks = 0, remaining = 0, generation = 0;
+            std::exception_ptr error;
+            bool stopping = false;
+        };
+
+    }  // namespace detail
+
+    /**
+     * @brief Run f(thread_id) on num_threads threads and wait for all of them.
+     *
+     * Thread 0 is the calling thread, so with num_threads <= 1 f(0) is simply
+     * called. The other ones are the workers of a pool started on first use
+     * and kept until the program exits, so repeated calls (every product of
+     * an iterative solver) start no thread. A call from inside a task, or
+     * while another thread uses the pool, starts threads for that call only.
+     * The other threads join the perf region open on the calling thread, if
+     * any. The first exception thrown by f is rethrown once all the tasks end.
+     */
+    template <typename F>
+    void run(std::size_t num_threads, F&& f) {
+        if (num_threads <= 1) {
+            f(std::size_t{0});
+            return;
+        }
+        const char* region = perf::current_region();
+        if (detail::inside_pool || !detail::ThreadPool::instance().try_run(num_threads, f, region))
+            detail::spawn(num_threads, f, region);
+    }
+
+}  // namespace parallel
+}  // namespace algebra
+
+#endif
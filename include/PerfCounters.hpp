@@ -0,0 +1,264 @@
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifdef ALGEBRA_PERF_COUNTERS
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <utility>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#endif
+
+/**
+ * @brief Opt-in hardware counters around the kernels.
+ *
+ * Compiled in only with -DALGEBRA_PERF_COUNTERS (make PERF=1). Without it
+ * ALGEBRA_PERF_REGION expands to nothing, WorkerRegion is an empty object
+ * and snapshot() returns nothing, so the instrumented code is unchanged.
+ *
+ * ALGEBRA_PERF_REGION("name") opens a region until the end of the scope: on
+ * Linux it reads cycles, instructions, last level cache misses and branch
+ * misses of the calling thread (user space only, perf_event_open) at both
+ * ends, and the differences are summed per region and per thread. The
+ * threads of a parallel::run inside a region open the same region with their
+ * thread index, thread 0 being the calling thread. Region names must be
+ * string literals. Where the counters cannot be opened (no permission, no
+ * PMU in the virtual machine) only calls and wall time are recorded.
+ */
+namespace algebra {
+namespace perf {
+
+    enum Event { CYCLES, INSTRUCTIONS, LLC_MISSES, BRANCH_MISSES, NUM_EVENTS };
+
+    inline constexpr std::array<const char*, NUM_EVENTS> event_names = {"cycles", "instructions", "llc_misses",
+                                                                        "branch_misses"};
+
+    //! totals of one region on one thread
+    struct RegionStats {
+        std::string name;
+        std::size_t thread = 0;
+        std::size_t calls = 0;
+        double wall_time = 0;  // micro seconds
+        std::array<std::uint64_t, NUM_EVENTS> counts{};
+        std::array<bool, NUM_EVENTS> counted{};  // false when the event could not be opened
+    };
+
+#ifdef ALGEBRA_PERF_COUNTERS
+
+    inline constexpr bool enabled = true;
+
+    namespace detail {
+
+        struct Reading {
+            std::array<std::uint64_t, NUM_EVENTS> values{};
+            std::uint64_t time_enabled = 0, time_running = 0;
+        };
+
+        // the counters of one thread, read together as a group; opened on the
+        // first region of the thread and closed when the thread exits
+        class EventGroup {
+        public:
+            EventGroup() {
+#ifdef __linux__
+                constexpr std::array<std::uint64_t, NUM_EVENTS> configs = {
+                    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                    PERF_COUNT_HW_CACHE_MISSES,  // last level cache misses on x86
+                    PERF_COUNT_HW_BRANCH_MISSES};
+                for (std::size_t e = 0; e < NUM_EVENTS; ++e) {
+                    perf_event_attr attr{};
+                    attr.size = sizeof(attr);
+                    attr.type = PERF_TYPE_HARDWARE;
+                    attr.config = configs[e];
+                    attr.disabled = leader < 0;
+                    attr.exclude_kernel = 1;
+                    attr.exclude_hv = 1;
+                    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+                    const int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+                    if (fd < 0) {
+                        if (leader < 0)
+                            return;  // without the cycles nothing is counted
+                        continue;
+                    }
+                    if (leader < 0)
+                        leader = fd;
+                    fds[e] = fd;
+                    slot[e] = num_open++;
+                }
+                ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+            }
+
+            ~EventGroup() {
+#ifdef __linux__
+                for (std::size_t e = NUM_EVENTS; e-- > 0;)
+                    if (fds[e] >= 0)
+                        close(fds[e]);
+#endif
+            }
+
+            EventGroup(const EventGroup&) = delete;
+            EventGroup& operator=(const EventGroup&) = delete;
+
+            bool is_counted(std::size_t e) const { return fds[e] >= 0; }
+
+            void read(Reading& reading) const {
+#ifdef __linux__
+                if (leader < 0)
+                    return;
+                std::array<std::uint64_t, 3 + NUM_EVENTS> buffer{};  // nr, enabled, running, values
+                if (::read(leader, buffer.data(), sizeof(buffer)) < 0)
+                    return;
+                reading.time_enabled = buffer[1];
+                reading.time_running = buffer[2];
+                for (std::size_t e = 0; e < NUM_EVENTS; ++e)
+                    if (fds[e] >= 0)
+                        reading.values[e] = buffer[3 + slot[e]];
+#else
+                (void)reading;
+#endif
+            }
+
+        private:
+            int leader = -1;
+            std::array<int, NUM_EVENTS> fds = {-1, -1, -1, -1};
+            std::array<std::size_t, NUM_EVENTS> slot{};  // position in the group read
+            std::size_t num_open = 0;
+        };
+
+        inline EventGroup& thread_group() {
+            thread_local EventGroup group;
+            return group;
+        }
+
+        // innermost region of the calling thread, inherited by parallel::run
+        inline const char*& thread_region() {
+            thread_local const char* name = nullptr;
+            return name;
+        }
+
+        struct Registry {
+            std::mutex mutex;
+            std::map<std::pair<std::string, std::size_t>, RegionStats> regions;
+        };
+
+        inline Registry& registry() {
+            static Registry r;
+            return r;
+        }
+
+    }  // namespace detail
+
+    class Region {
+    public:
+        explicit Region(const char* name, std::size_t thread = 0)
+            : name(name), thread(thread), parent(detail::thread_region()), group(detail::thread_group()) {
+            detail::thread_region() = name;
+            start_time = std::chrono::steady_clock::now();
+            group.read(start);
+        }
+
+        ~Region() {
+            detail::Reading stop;
+            group.read(stop);
+            const auto stop_time = std::chrono::steady_clock::now();
+            detail::thread_region() = parent;
+
+            // when the counters were multiplexed, scale to the whole region
+            const std::uint64_t enabled = stop.time_enabled - start.time_enabled;
+            const std::uint64_t running = stop.time_running - start.time_running;
+            const double scale = running > 0 && running < enabled ? double(enabled) / running : 1.0;
+
+            auto& registry = detail::registry();
+            std::lock_guard lock(registry.mutex);
+            RegionStats& stats = registry.regions[{name, thread}];
+            stats.name = name;
+            stats.thread = thread;
+            ++stats.calls;
+            stats.wall_time += std::chrono::duration<double, std::micro>(stop_time - start_time).count();
+            for (std::size_t e = 0; e < NUM_EVENTS; ++e) {
+                stats.counted[e] = group.is_counted(e);
+                stats.counts[e] += static_cast<std::uint64_t>((stop.values[e] - start.values[e]) * scale);
+            }
+        }
+
+        Region(const Region&) = delete;
+        Region& operator=(const Region&) = delete;
+
+    private:
+        const char* name;
+        std::size_t thread;
+        const char* parent;
+        const detail::EventGroup& group;
+        detail::Reading start;
+        std::chrono::steady_clock::time_point start_time;
+    };
+
+    //! region of a worker thread of parallel::run, nothing when started outside any region
+    class WorkerRegion {
+    public:
+        WorkerRegion(const char* name, std::size_t thread) {
+            if (name != nullptr)
+                region.emplace(name, thread);
+        }
+
+    private:
+        std::optional<Region> region;
+    };
+
+    //! name of the innermost region open on the calling thread, nullptr if none
+    inline const char* current_region() { return detail::thread_region(); }
+
+    //! totals of every region and thread since the last reset(), by name then thread
+    inline std::vector<RegionStats> snapshot() {
+        auto& registry = detail::registry();
+        std::lock_guard lock(registry.mutex);
+        std::vector<RegionStats> out;
+        out.reserve(registry.regions.size());
+        for (const auto& [key, stats] : registry.regions)
+            out.push_back(stats);
+        return out;
+    }
+
+    inline void reset() {
+        auto& registry = detail::registry();
+        std::lock_guard lock(registry.mutex);
+        registry.regions.clear();
+    }
+
+#define ALGEBRA_PERF_CONCAT_IMPL(a, b) a##b
+#define ALGEBRA_PERF_CONCAT(a, b) ALGEBRA_PERF_CONCAT_IMPL(a, b)
+#define ALGEBRA_PERF_REGION(...) ::algebra::perf::Region ALGEBRA_PERF_CONCAT(perf_region_, __LINE__)(__VA_ARGS__)
+
+#else
+
+    inline constexpr bool enabled = false;
+
+    class WorkerRegion {
+    public:
+        constexpr WorkerRegion(const char*, std::size_t) {}
+    };
+
+    constexpr const char* current_region() { return nullptr; }
+    inline std::vector<RegionStats> snapshot() { return {}; }
+    inline void reset() {}
+
+#define ALGEBRA_PERF_REGION(...) ((void)0)
+
+#endif
+
+}  // namespace perf
+}  // namespace algebra
+
+#endif
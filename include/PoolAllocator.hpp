@@ -0,0 +1,145 @@
+#ifndef POOL_ALLOCATOR_HPP
+#define POOL_ALLOCATOR_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace algebra {
+
+/**
+ * @brief Arena of small fixed-size blocks, for the nodes of node based
+ * containers.
+ *
+ * Blocks are carved from chunks that grow geometrically (64KB up to 16MB), a
+ * freed block goes to the free list of its size class and is reused by the
+ * next allocation of that size; the chunks are only given back, all at once,
+ * when the pool is destroyed. Sizes above max_block, or alignments above
+ * granularity, go to the global operator new. Not thread safe.
+ */
+class NodePool {
+public:
+    static constexpr std::size_t granularity = alignof(std::max_align_t);
+    static constexpr std::size_t max_block = 256;
+    static constexpr std::size_t first_chunk = std::size_t{1} << 16;
+    static constexpr std::size_t max_chunk = std::size_t{1} << 24;
+
+    NodePool() = default;
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    ~NodePool() {
+        for (void* chunk : chunks)
+            ::operator delete(chunk);
+    }
+
+    void* allocate(std::size_t bytes, std::size_t alignment) {
+        if (bytes > max_block || alignment > granularity)
+            return ::operator new(bytes, std::align_val_t(std::max(alignment, granularity)));
+        const std::size_t size_class = (bytes + granularity - 1) / granularity;
+        if (FreeBlock* block = free_lists[size_class]) {
+            free_lists[size_class] = block->next;
+            return block;
+        }
+        const std::size_t size = size_class * granularity;
+        if (remaining < size)
+            grow(size);
+        void* p = cursor;
+        cursor += size;
+        remaining -= size;
+        return p;
+    }
+
+    void deallocate(void* p, std::size_t bytes, std::size_t alignment) noexcept {
+        if (bytes > max_block || alignment > granularity) {
+            ::operator delete(p, std::align_val_t(std::max(alignment, granularity)));
+            return;
+        }
+        const std::size_t size_class = (bytes + granularity - 1) / granularity;
+        free_lists[size_class] = ::new (p) FreeBlock{free_lists[size_class]};
+    }
+
+    // bytes taken from the global allocator by the chunks
+    std::size_t get_reserved() const { return reserved; }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    void grow(std::size_t min_size) {
+        const std::size_t size = std::max(next_chunk, min_size);
+        chunks.push_back(::operator new(size));
+        cursor = static_cast<std::byte*>(chunks.back());
+        remaining = size;
+        reserved += size;
+        next_chunk = std::min(2 * next_chunk, max_chunk);
+    }
+
+    std::vector<void*> chunks;
+    std::byte* cursor = nullptr;
+    std::size_t remaining = 0, reserved = 0;
+    std::size_t next_chunk = first_chunk;
+    std::array<FreeBlock*, max_block / granularity + 1> free_lists{};
+};
+
+/**
+ * @brief Standard allocator over a shared NodePool.
+ *
+ * A default constructed allocator owns a new pool, rebound copies share it.
+ * A container copy gets a pool of its own (select_on_container_copy_construction),
+ * so that pools are never shared between independent containers; on move and
+ * swap the pool follows the elements. A moved allocator keeps its pool, as
+ * standard allocators stay equal to their moved copies: a moved-from
+ * container can still be filled, sharing the pool of the one it was moved to.
+ */
+template <typename U>
+class PoolAllocator {
+public:
+    using value_type = U;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    using is_always_equal = std::false_type;
+
+    PoolAllocator() : pool(std::make_shared<NodePool>()) {}
+
+    // moves copy the pool pointer, so that the source is never left without one
+    PoolAllocator(const PoolAllocator& other) noexcept : pool(other.pool) {}
+    PoolAllocator(PoolAllocator&& other) noexcept : pool(other.pool) {}
+    PoolAllocator& operator=(const PoolAllocator& other) noexcept {
+        pool = other.pool;
+        return *this;
+    }
+    PoolAllocator& operator=(PoolAllocator&& other) noexcept {
+        pool = other.pool;
+        return *this;
+    }
+
+    template <typename V>
+    PoolAllocator(const PoolAllocator<V>& other) noexcept : pool(other.pool) {}
+
+    U* allocate(std::size_t n) { return static_cast<U*>(pool->allocate(n * sizeof(U), alignof(U))); }
+    void deallocate(U* p, std::size_t n) noexcept { pool->deallocate(p, n * sizeof(U), alignof(U)); }
+
+    PoolAllocator select_on_container_copy_construction() const { return PoolAllocator(); }
+
+    const NodePool& get_pool() const { return *pool; }
+
+    template <typename V>
+    bool operator==(const PoolAllocator<V>& other) const noexcept { return pool == other.pool; }
+
+private:
+    template <typename V>
+    friend class PoolAllocator;
+
+    std::shared_ptr<NodePool> pool;
+};
+
+}  // namespace algebra
+
+#endif
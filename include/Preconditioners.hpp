@@ -0,0 +1,286 @@
+#ifndef PRECONDITIONERS_HPP
+#define PRECONDITIONERS_HPP
+
+#include <algorithm>
+#include <barrier>
+#include <cmath>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "Matrix.hpp"
+#include "Parallel.hpp"
+#include "SparseKernels.hpp"
+#include "Utils.hpp"
+
+namespace algebra {
+namespace solvers {
+
+    /**
+     * @brief Jacobi preconditioner, z = D^-1 r.
+     *
+     * Rows without a (nonzero) diagonal entry are left unscaled.
+     */
+    template <Numeric T>
+    class JacobiPreconditioner {
+    public:
+        template <StorageOrder order, IndexType Index>
+        explicit JacobiPreconditioner(const Matrix<T, order, Index>& A) : inv_diag(A.get_rows(), T(1)) {
+            if (A.get_rows() != A.get_cols())
+                throw std::invalid_argument("Preconditioners need a square matrix");
+            const auto& const_A = A;
+            for (std::size_t i = 0; i < A.get_rows(); ++i) {
+                const T d = const_A(i, i);
+                if (d != T(0))
+                    inv_diag[i] = T(1) / d;
+            }
+        }
+
+        void apply(std::span<const T> r, std::span<T> z) const {
+            for (std::size_t i = 0; i < inv_diag.size(); ++i)
+                z[i] = inv_diag[i] * r[i];
+        }
+
+    private:
+        std::vector<T> inv_diag;
+    };
+
+    namespace detail {
+
+        /**
+         * @brief CSR copy of a square matrix with a diagonal entry in every row,
+         * and the level schedules of its lower and upper triangular solves.
+         *
+         * Missing diagonal entries are added to the pattern as explicit zeros.
+         * The triangular solves run level by level on num_threads threads, with
+         * a barrier between levels; when the levels hold few rows (long
+         * dependency chains) the barriers would cost more than the rows and the
+         * rows are solved serially.
+         */
+        template <Numeric T, IndexType Index>
+        class TriangularSystem {
+        public:
+            // rows per level per thread below which the serial solve is used
+            static constexpr std::size_t min_rows_per_thread = 32;
+
+            TriangularSystem() = default;
+
+            template <StorageOrder order>
+            explicit TriangularSystem(const Matrix<T, order, Index>& A) {
+                if (A.get_rows() != A.get_cols())
+                    throw std::invalid_argument("Preconditioners need a square matrix");
+                if constexpr (order == ROW_MAJOR) {
+                    if (A.is_fully_compressed()) {
+                        build(A);
+                        return;
+                    }
+                    Matrix<T, ROW_MAJOR, Index> A_compressed = A;
+                    A_compressed.compress();
+                    build(A_compressed);
+                } else {
+                    Matrix<T, COL_MAJOR, Index> A_compressed = A;
+                    A_compressed.compress();
+                    build(A_compressed.template convert<ROW_MAJOR>());
+                }
+            }
+
+            std::size_t size() const { return diag.size(); }
+
+            // x = (b - scale * (strictly lower or upper part) x) * inv_diag
+            template <bool lower>
+            void solve(std::span<const T> inv_diag, T scale, std::span<const T> b, std::span<T> x) const {
+                const auto& level_ptr = lower ? lower_level_ptr : upper_level_ptr;
+                const auto& level_rows = lower ? lower_rows : upper_rows;
+                const std::size_t num_levels = level_ptr.size() - 1;
+                if (num_threads <= 1 || size() < num_levels * num_threads * min_rows_per_thread) {
+                    kernels::sptrsv_rows<T, Index, lower>(ptr, idx, val, diag, inv_diag, scale, b, x, {}, 0, size());
+                    return;
+                }
+                std::barrier sync(static_cast<std::ptrdiff_t>(num_threads));
+                parallel::run(num_threads, [&](std::size_t t) {
+                    for (std::size_t l = 0; l < num_levels; ++l) {
+                        const std::size_t begin = level_ptr[l], count = level_ptr[l + 1] - begin;
+                        kernels::sptrsv_rows<T, Index, lower>(ptr, idx, val, diag, inv_diag, scale, b, x, level_rows,
+                                                              begin + count * t / num_threads,
+                                                              begin + count * (t + 1) / num_threads);
+                        sync.arrive_and_wait();
+                    }
+                });
+            }
+
+            std::size_t num_levels(bool lower) const {
+                return (lower ? lower_level_ptr : upper_level_ptr).size() - 1;
+            }
+
+            std::vector<Index> ptr, idx;
+            std::vector<T> val;
+            std::vector<Index> diag;  // position of the diagonal entry of every row
+            std::size_t num_threads = 1;
+
+        private:
+            void build(const Matrix<T, ROW_MAJOR, Index>& A) {
+                const std::size_t n = A.get_rows();
+                const auto& a_ptr = A.get_row_indices();
+                const auto& a_idx = A.get_col_indices();
+                const auto& a_val = A.get_values();
+                std::size_t missing = 0;
+                for (std::size_t i = 0; i < n; ++i)
+                    missing += !std::binary_search(a_idx.begin() + a_ptr[i], a_idx.begin() + a_ptr[i + 1], static_cast<Index>(i));
+                if (a_val.size() + missing > std::numeric_limits<Index>::max())
+                    throw std::overflow_error("Too many non zeros for the chosen index type");
+
+                ptr.assign(n + 1, 0);
+                idx.clear();
+                val.clear();
+                idx.reserve(a_val.size() + missing);
+                val.reserve(a_val.size() + missing);
+                diag.resize(n);
+                for (std::size_t i = 0; i < n; ++i) {
+                    bool diag_done = false;
+                    for (std::size_t k = a_ptr[i]; k < a_ptr[i + 1]; ++k) {
+                        if (!diag_done && a_idx[k] >= i) {
+                            diag[i] = static_cast<Index>(idx.size());
+                            if (a_idx[k] != i) {
+                                idx.push_back(static_cast<Index>(i));
+                                val.push_back(T(0));
+                            }
+                            diag_done = true;
+                        }
+                        idx.push_back(a_idx[k]);
+                        val.push_back(a_val[k]);
+                    }
+                    if (!diag_done) {
+                        diag[i] = static_cast<Index>(idx.size());
+                        idx.push_back(static_cast<Index>(i));
+                        val.push_back(T(0));
+                    }
+                    ptr[i + 1] = static_cast<Index>(idx.size());
+                }
+                kernels::level_schedule<Index, true>(ptr, idx, diag, lower_level_ptr, lower_rows);
+                kernels::level_schedule<Index, false>(ptr, idx, diag, upper_level_ptr, upper_rows);
+            }
+
+            std::vector<Index> lower_level_ptr, lower_rows;
+            std::vector<Index> upper_level_ptr, upper_rows;
+        };
+
+    }  // namespace detail
+
+    /**
+     * @brief Incomplete LU factorization with no fill-in, ILU(0).
+     *
+     * L (unit diagonal) and U are computed in place on a CSR copy of the
+     * pattern of A, the diagonal included. A zero pivot (e.g. a diagonal
+     * entry missing from A) is replaced by the largest entry of its row, so
+     * that the factorization always completes and M^-1 stays bounded.
+     * apply() is a forward and a backward level scheduled triangular solve.
+     */
+    template <Numeric T, IndexType Index = std::size_t>
+    class ILU0Preconditioner {
+    public:
+        template <StorageOrder order>
+        explicit ILU0Preconditioner(const Matrix<T, order, Index>& A) : system(A) {
+            factorize();
+        }
+
+        void set_num_threads(std::size_t n) { system.num_threads = n == 0 ? parallel::hardware_threads() : n; }
+        std::size_t get_num_threads() const { return system.num_threads; }
+        std::size_t get_num_levels() const { return system.num_levels(true); }
+
+        void apply(std::span<const T> r, std::span<T> z) const {
+            system.template solve<true>({}, T(1), r, z);
+            system.template solve<false>(inv_diag, T(1), z, z);
+        }
+
+    private:
+        void factorize();
+
+        detail::TriangularSystem<T, Index> system;
+        std::vector<T> inv_diag;  // of U
+    };
+
+    // IKJ variant: row i is updated by the rows k < i of its lower part, a
+    // marker array maps the columns of row i to their positions
+    template <Numeric T, IndexType Index>
+    void ILU0Preconditioner<T, Index>::factorize() {
+        const std::size_t n = system.size();
+        const auto& ptr = system.ptr;
+        const auto& idx = system.idx;
+        const auto& diag = system.diag;
+        auto& val = system.val;
+        using Real = real_type_t<T>;
+        constexpr std::size_t unmarked = static_cast<std::size_t>(-1);
+        std::vector<std::size_t> position(n, unmarked);
+        inv_diag.resize(n);
+
+        for (std::size_t i = 0; i < n; ++i) {
+            Real row_max = 0;
+            for (std::size_t k = ptr[i]; k < ptr[i + 1]; ++k) {
+                position[idx[k]] = k;
+                row_max = std::max<Real>(row_max, std::abs(val[k]));
+            }
+            for (std::size_t p = ptr[i]; p < diag[i]; ++p) {
+                const std::size_t k = idx[p];
+                val[p] *= inv_diag[k];
+                const T l_ik = val[p];
+                for (std::size_t q = diag[k] + 1; q < ptr[k + 1]; ++q) {
+                    const std::size_t pos = position[idx[q]];
+                    if (pos != unmarked)
+                        val[pos] -= l_ik * val[q];
+                }
+            }
+            T& pivot = val[diag[i]];
+            if (pivot == T(0))
+                pivot = (row_max == 0 ? Real(1) : row_max);
+            inv_diag[i] = T(1) / pivot;
+            for (std::size_t k = ptr[i]; k < ptr[i + 1]; ++k)
+                position[idx[k]] = unmarked;
+        }
+    }
+
+    /**
+     * @brief Symmetric successive over-relaxation (SSOR) preconditioner,
+     * M = (D + omega L) D^-1 (D + omega U) / (omega (2 - omega)).
+     *
+     * The sweeps are the triangular solves of ILU0Preconditioner, level
+     * scheduled on the pattern of A. Rows with a zero diagonal are not scaled.
+     */
+    template <Numeric T, IndexType Index = std::size_t>
+    class SSORPreconditioner {
+    public:
+        template <StorageOrder order>
+        explicit SSORPreconditioner(const Matrix<T, order, Index>& A, real_type_t<T> omega = 1) : system(A), omega(omega) {
+            if (!(omega > 0 && omega < 2))
+                throw std::invalid_argument("SSOR needs 0 < omega < 2");
+            diagonal.resize(system.size());
+            inv_diag.resize(system.size());
+            for (std::size_t i = 0; i < system.size(); ++i) {
+                const T d = system.val[system.diag[i]];
+                diagonal[i] = d == T(0) ? T(1) : d;
+                inv_diag[i] = T(1) / diagonal[i];
+            }
+        }
+
+        void set_num_threads(std::size_t n) { system.num_threads = n == 0 ? parallel::hardware_threads() : n; }
+        std::size_t get_num_threads() const { return system.num_threads; }
+
+        // (D + omega L) u = r, then (D + omega U) z = omega (2 - omega) D u in place
+        void apply(std::span<const T> r, std::span<T> z) const {
+            system.template solve<true>(inv_diag, T(omega), r, z);
+            const T factor = T(omega * (2 - omega));
+            for (std::size_t i = 0; i < diagonal.size(); ++i)
+                z[i] *= factor * diagonal[i];
+            system.template solve<false>(inv_diag, T(omega), z, z);
+        }
+
+    private:
+        detail::TriangularSystem<T, Index> system;
+        real_type_t<T> omega;
+        std::vector<T> diagonal, inv_diag;
+    };
+
+}  // namespace solvers
+}  // namespace algebra
+
+#endif
@@ -0,0 +1,369 @@
+#ifndef REORDERING_HPP
+#define REORDERING_HPP
+
+#include <algorithm>
+#include <cstdlib>
+#include <numeric>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "Matrix.hpp"
+#include "Parallel.hpp"
+#include "SparseKernels.hpp"
+#include "Utils.hpp"
+
+namespace algebra {
+namespace reordering {
+
+    enum Ordering { ORDERING_NATURAL, ORDERING_RCM, ORDERING_DEGREE };
+
+    namespace detail {
+
+        // undirected graph of the pattern of A + A^T, without the diagonal
+        struct Graph {
+            std::vector<std::size_t> ptr, adj;
+
+            std::size_t size() const { return ptr.size() - 1; }
+            std::size_t degree(std::size_t i) const { return ptr[i + 1] - ptr[i]; }
+        };
+
+        template <Numeric T, StorageOrder order, IndexType Index>
+        Graph build_graph(const Matrix<T, order, Index>& A) {
+            if (!A.is_fully_compressed()) {
+                Matrix<T, order, Index> A_compressed = A;
+                A_compressed.compress();
+                return build_graph(A_compressed);
+            }
+            const std::size_t n = A.get_rows();
+            const auto& ptr = order == ROW_MAJOR ? A.get_row_indices() : A.get_col_indices();
+            const auto& idx = order == ROW_MAJOR ? A.get_col_indices() : A.get_row_indices();
+
+            // every edge in both directions, then sorted and made unique per vertex
+            Graph g;
+            g.ptr.assign(n + 1, 0);
+            for (std::size_t i = 0; i < n; ++i) {
+                for (std::size_t k = ptr[i]; k < ptr[i + 1]; ++k) {
+                    if (idx[k] != i) {
+                        ++g.ptr[i + 1];
+                        ++g.ptr[idx[k] + 1];
+                    }
+                }
+            }
+            std::partial_sum(g.ptr.begin(), g.ptr.end(), g.ptr.begin());
+            g.adj.resize(g.ptr[n]);
+            std::vector<std::size_t> next(g.ptr.begin(), g.ptr.end() - 1);
+            for (std::size_t i = 0; i < n; ++i) {
+                for (std::size_t k = ptr[i]; k < ptr[i + 1]; ++k) {
+                    const std::size_t j = idx[k];
+                    if (j != i) {
+                        g.adj[next[i]++] = j;
+                        g.adj[next[j]++] = i;
+                    }
+                }
+            }
+            std::size_t pos = 0;
+            for (std::size_t i = 0; i < n; ++i) {
+                const auto first = g.adj.begin() + g.ptr[i], last = g.adj.begin() + g.ptr[i + 1];
+                std::sort(first, last);
+                const auto end = std::unique(first, last);
+                const std::size_t begin = pos;
+                for (auto it = first; it != end; ++it)
+                    g.adj[pos++] = *it;
+                g.ptr[i] = begin;
+            }
+            g.ptr[n] = pos;
+            g.adj.resize(pos);
+            return g;
+        }
+
+        // breadth first search from root over the vertices with mark[v] != stamp:
+        // the vertices are appended to order, the number of levels is returned
+        // and the vertices of the last level are order[last_begin, end)
+        inline std::size_t bfs_levels(const Graph& g, std::size_t root, std::vector<std::size_t>& mark,
+                                      std::size_t stamp, std::vector<std::size_t>& order, std::size_t& last_begin) {
+            order.clear();
+            order.push_back(root);
+            mark[root] = stamp;
+            std::size_t num_levels = 0, level_begin = 0;
+            while (level_begin < order.size()) {
+                const std::size_t level_end = order.size();
+                last_begin = level_begin;
+                for (std::size_t p = level_begin; p < level_end; ++p) {
+                    for (std::size_t k = g.ptr[order[p]]; k < g.ptr[order[p] + 1]; ++k) {
+                        if (mark[g.adj[k]] != stamp) {
+                            mark[g.adj[k]] = stamp;
+                            order.push_back(g.adj[k]);
+                        }
+                    }
+                }
+                level_begin = level_end;
+                ++num_levels;
+            }
+            return num_levels;
+        }
+
+    }  // namespace detail
+
+    //! old index of every new index -> new index of every old index
+    inline std::vector<std::size_t> inverse_permutation(std::span<const std::size_t> perm) {
+        constexpr std::size_t unset = static_cast<std::size_t>(-1);
+        std::vector<std::size_t> inverse(perm.size(), unset);
+        for (std::size_t i = 0; i < perm.size(); ++i) {
+            if (perm[i] >= perm.size() || inverse[perm[i]] != unset)
+                throw std::invalid_argument("Not a permutation");
+            inverse[perm[i]] = i;
+        }
+        return inverse;
+    }
+
+    /**
+     * @brief Reverse Cuthill-McKee ordering of the pattern of A + A^T.
+     *
+     * Every connected component is numbered breadth first, neighbours by
+     * increasing degree, from a pseudo-peripheral vertex (George-Liu search
+     * started at the vertex of minimum degree); the whole order is then
+     * reversed. perm[new] = old, as expected by permute().
+     */
+    template <Numeric T, StorageOrder order, IndexType Index>
+    std::vector<std::size_t> reverse_cuthill_mckee(const Matrix<T, order, Index>& A) {
+        if (A.get_rows() != A.get_cols())
+            throw std::invalid_argument("Symmetric reordering needs a square matrix");
+        const detail::Graph g = detail::build_graph(A);
+        const std::size_t n = g.size();
+
+        std::vector<std::size_t> by_degree(n);
+        std::iota(by_degree.begin(), by_degree.end(), 0);
+        std::stable_sort(by_degree.begin(), by_degree.end(),
+                         [&](std::size_t a, std::size_t b) { return g.degree(a) < g.degree(b); });
+
+        std::vector<std::size_t> perm;
+        perm.reserve(n);
+        std::vector<bool> numbered(n, false);
+        std::vector<std::size_t> mark(n, 0), level_order;
+        std::size_t stamp = 0;
+        for (std::size_t seed : by_degree) {
+            if (numbered[seed])
+                continue;
+
+            // pseudo-peripheral vertex: move to the vertex of minimum degree of
+            // the last level while the eccentricity grows
+            std::size_t root = seed, last_begin = 0;
+            std::size_t num_levels = detail::bfs_levels(g, root, mark, ++stamp, level_order, last_begin);
+            while (true) {
+                std::size_t candidate = level_order[last_begin];
+                for (std::size_t p = last_begin; p < level_order.size(); ++p)
+                    if (g.degree(level_order[p]) < g.degree(candidate))
+                        candidate = level_order[p];
+                std::size_t candidate_last = 0;
+                const std::size_t candidate_levels =
+                    detail::bfs_levels(g, candidate, mark, ++stamp, level_order, candidate_last);
+                if (candidate_levels <= num_levels)
+                    break;
+                root = candidate;
+                num_levels = candidate_levels;
+                last_begin = candidate_last;
+            }
+
+            // Cuthill-McKee from root
+            const std::size_t begin = perm.size();
+            perm.push_back(root);
+            numbered[root] = true;
+            for (std::size_t p = begin; p < perm.size(); ++p) {
+                const std::size_t u = perm[p];
+                const std::size_t first_new = perm.size();
+                for (std::size_t k = g.ptr[u]; k < g.ptr[u + 1]; ++k) {
+                    if (!numbered[g.adj[k]]) {
+                        numbered[g.adj[k]] = true;
+                        perm.push_back(g.adj[k]);
+                    }
+                }
+                std::stable_sort(perm.begin() + first_new, perm.end(),
+                                 [&](std::size_t a, std::size_t b) { return g.degree(a) < g.degree(b); });
+            }
+        }
+        std::reverse(perm.begin(), perm.end());
+        return perm;
+    }
+
+    //! vertices by increasing degree in the pattern of A + A^T (ties keep their order)
+    template <Numeric T, StorageOrder order, IndexType Index>
+    std::vector<std::size_t> degree_ordering(const Matrix<T, order, Index>& A) {
+        if (A.get_rows() != A.get_cols())
+            throw std::invalid_argument("Symmetric reordering needs a square matrix");
+        const detail::Graph g = detail::build_graph(A);
+        std::vector<std::size_t> perm(g.size());
+        std::iota(perm.begin(), perm.end(), 0);
+        std::stable_sort(perm.begin(), perm.end(), [&](std::size_t a, std::size_t b) { return g.degree(a) < g.degree(b); });
+        return perm;
+    }
+
+    template <Numeric T, StorageOrder order, IndexType Index>
+    std::vector<std::size_t> compute_ordering(const Matrix<T, order, Index>& A, Ordering ordering) {
+        switch (ordering) {
+        case ORDERING_RCM:
+            return reverse_cuthill_mckee(A);
+        case ORDERING_DEGREE:
+            return degree_ordering(A);
+        default: {
+            std::vector<std::size_t> perm(A.get_rows());
+            std::iota(perm.begin(), perm.end(), 0);
+            return perm;
+        }
+        }
+    }
+
+    /**
+     * @brief Symmetric permutation B = P A P^T, B(i, j) = A(perm[i], perm[j]).
+     *
+     * The lines are permuted with their inner indices renumbered and sorted
+     * again, in parallel over the threads of A. B keeps the storage order,
+     * the compression state and the threads of A.
+     */
+    template <Numeric T, StorageOrder order, IndexType Index>
+    Matrix<T, order, Index> permute(const Matrix<T, order, Index>& A, std::span<const std::size_t> perm) {
+        const std::size_t n = A.get_rows();
+        if (A.get_cols() != n)
+            throw std::invalid_argument("Symmetric reordering needs a square matrix");
+        if (perm.size() != n)
+            throw std::invalid_argument("The permutation does not match the matrix dimensions");
+        if (!A.is_fully_compressed()) {
+            Matrix<T, order, Index> A_compressed = A;
+            A_compressed.compress();
+            Matrix<T, order, Index> B = permute(A_compressed, perm);
+            if (!A.is_compressed())
+                B.uncompress();
+            return B;
+        }
+        const std::vector<std::size_t> inverse = inverse_permutation(perm);
+        const auto& ptr = order == ROW_MAJOR ? A.get_row_indices() : A.get_col_indices();
+        const auto& idx = order == ROW_MAJOR ? A.get_col_indices() : A.get_row_indices();
+        const auto& val = A.get_values();
+
+        std::vector<Index> new_ptr(n + 1, 0);
+        for (std::size_t i = 0; i < n; ++i)
+            new_ptr[i + 1] = new_ptr[i] + (ptr[perm[i] + 1] - ptr[perm[i]]);
+        std::vector<Index> new_idx(val.size());
+        std::vector<T> new_val(val.size());
+
+        const std::size_t num_threads = A.get_num_threads();
+        const auto bounds = kernels::balanced_partition<Index>(new_ptr, num_threads);
+        parallel::run(num_threads, [&](std::size_t t) {
+            for (std::size_t i = bounds[t]; i < bounds[t + 1]; ++i) {
+                std::size_t dest = new_ptr[i];
+                for (std::size_t k = ptr[perm[i]]; k < ptr[perm[i] + 1]; ++k, ++dest) {
+                    new_idx[dest] = static_cast<Index>(inverse[idx[k]]);
+                    new_val[dest] = val[k];
+                }
+            }
+            kernels::sort_lines<T, Index>(new_ptr, new_idx, new_val, bounds[t], bounds[t + 1]);
+        });
+
+        Matrix<T, order, Index> B = order == ROW_MAJOR
+            ? Matrix<T, order, Index>(std::move(new_val), std::move(new_ptr), std::move(new_idx), n, n)
+            : Matrix<T, order, Index>(std::move(new_val), std::move(new_idx), std::move(new_ptr), n, n);
+        B.set_num_threads(num_threads);
+        return B;
+    }
+
+    //! out[i] = x[perm[i]]: from the original numbering to the permuted one
+    template <Numeric T>
+    void permute_vector(std::span<const T> x, std::span<const std::size_t> perm, std::span<T> out) {
+        for (std::size_t i = 0; i < perm.size(); ++i)
+            out[i] = x[perm[i]];
+    }
+
+    //! out[perm[i]] = x[i]: from the permuted numbering back to the original one
+    template <Numeric T>
+    void unpermute_vector(std::span<const T> x, std::span<const std::size_t> perm, std::span<T> out) {
+        for (std::size_t i = 0; i < perm.size(); ++i)
+            out[perm[i]] = x[i];
+    }
+
+    template <Numeric T>
+    std::vector<T> permute_vector(const std::vector<T>& x, std::span<const std::size_t> perm) {
+        std::vector<T> out(perm.size());
+        permute_vector<T>(x, perm, out);
+        return out;
+    }
+
+    template <Numeric T>
+    std::vector<T> unpermute_vector(const std::vector<T>& x, std::span<const std::size_t> perm) {
+        std::vector<T> out(perm.size());
+        unpermute_vector<T>(x, perm, out);
+        return out;
+    }
+
+    //! max |i - j| over the entries of A
+    template <Numeric T, StorageOrder order, IndexType Index>
+    std::size_t bandwidth(const Matrix<T, order, Index>& A) {
+        if (!A.is_fully_compressed()) {
+            Matrix<T, order, Index> A_compressed = A;
+            A_compressed.compress();
+            return bandwidth(A_compressed);
+        }
+        const auto& ptr = order == ROW_MAJOR ? A.get_row_indices() : A.get_col_indices();
+        const auto& idx = order == ROW_MAJOR ? A.get_col_indices() : A.get_row_indices();
+        std::size_t band = 0;
+        for (std::size_t i = 0; i + 1 < ptr.size(); ++i)
+            for (std::size_t k = ptr[i]; k < ptr[i + 1]; ++k)
+                band = std::max<std::size_t>(band, idx[k] > i ? idx[k] - i : i - idx[k]);
+        return band;
+    }
+
+    /**
+     * @brief A symmetrically permuted copy of a matrix behind the original
+     * numbering: the products permute x in and y out, so that callers keep
+     * their own indexing and get the locality of the reordered matrix.
+     *
+     * The permuted x and y live in two work vectors: the caller's, or vectors
+     * allocated by every product when none are given.
+     */
+    template <Numeric T, StorageOrder order, IndexType Index = std::size_t>
+    class ReorderedMatrix {
+    public:
+        explicit ReorderedMatrix(const Matrix<T, order, Index>& A, Ordering ordering = ORDERING_RCM)
+            : perm(compute_ordering(A, ordering)), matrix(permute(A, std::span<const std::size_t>(perm))) {
+            if (!matrix.is_fully_compressed())
+                matrix.compress();
+        }
+
+        const Matrix<T, order, Index>& get_matrix() const { return matrix; }
+        const std::vector<std::size_t>& get_permutation() const { return perm; }
+        std::size_t get_rows() const { return matrix.get_rows(); }
+        std::size_t get_cols() const { return matrix.get_cols(); }
+        void set_num_threads(std::size_t n) { matrix.set_num_threads(n); }
+
+        // y = alpha * A x + beta * y, x and y in the original numbering
+        void multiply(std::span<const T> x, std::span<T> y, T alpha = T(1), T beta = T(0)) const {
+            std::vector<T> x_work(get_cols()), y_work(get_rows());
+            multiply(x, y, x_work, y_work, alpha, beta);
+        }
+
+        // the same on the caller's work vectors, of get_cols() and get_rows() entries
+        void multiply(std::span<const T> x, std::span<T> y, std::span<T> x_work, std::span<T> y_work,
+                      T alpha = T(1), T beta = T(0)) const {
+            if (x.size() < get_cols() || y.size() < get_rows() || x_work.size() < get_cols() || y_work.size() < get_rows())
+                throw std::invalid_argument("Vector sizes do not match the matrix dimensions");
+            permute_vector<T>(x, perm, x_work);
+            if (beta != T(0))
+                permute_vector<T>(y, perm, y_work);
+            matrix.multiply(x_work, y_work, alpha, beta);
+            unpermute_vector<T>(y_work, perm, y);
+        }
+
+        friend std::vector<T> operator*(const ReorderedMatrix& m, const std::vector<T>& x) {
+            std::vector<T> y(m.get_rows());
+            m.multiply(x, y);
+            return y;
+        }
+
+    private:
+        std::vector<std::size_t> perm;  // perm[new] = old
+        Matrix<T, order, Index> matrix;
+    };
+
+}  // namespace reordering
+}  // namespace algebra
+
+#endif
@@ -0,0 +1,270 @@
+#ifndef SELL_KERNELS_HPP
+#define SELL_KERNELS_HPP
+
+#include <array>
+#include <complex>
+#include <cstddef>
+#include <span>
+#include <type_traits>
+
+#include "Utils.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ALGEBRA_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace algebra {
+
+// instruction sets the SELL-C-sigma kernels can use, in increasing order
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_AVX2,
+    SIMD_AVX512
+};
+
+namespace kernels {
+
+    //! best SimdLevel of the running CPU, detected once
+    inline SimdLevel detect_simd() {
+#ifdef ALGEBRA_X86_SIMD
+        static const SimdLevel level = [] {
+            __builtin_cpu_init();
+            if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("fma"))
+                return SIMD_SCALAR;
+            return __builtin_cpu_supports("avx512f") ? SIMD_AVX512 : SIMD_AVX2;
+        }();
+        return level;
+#else
+        return SIMD_SCALAR;
+#endif
+    }
+
+    /**
+     * @brief y[c * C + r] = row r of chunk c times x, for the chunks [begin, end).
+     *
+     * SELL-C-sigma layout: the rows are grouped in chunks of C rows, every row of
+     * a chunk is padded (value 0) to the length of the longest one and the chunk
+     * is stored column by column, so that entry j of row r lives at
+     * chunk_ptr[c] + j * C + r. The C rows of a chunk are independent lanes.
+     */
+    template <typename T, typename Index, std::size_t C>
+    void sell_spmv_scalar(std::span<const Index> chunk_ptr, std::span<const Index> idx, std::span<const T> val,
+                          std::span<const T> x, std::span<T> y, std::size_t begin, std::size_t end) {
+        for (std::size_t c = begin; c < end; ++c) {
+            std::array<T, C> acc{};
+            for (std::size_t k = chunk_ptr[c]; k < chunk_ptr[c + 1]; k += C)
+                for (std::size_t r = 0; r < C; ++r)
+                    acc[r] += val[k + r] * x[idx[k + r]];
+            for (std::size_t r = 0; r < C; ++r)
+                y[c * C + r] = acc[r];
+        }
+    }
+
+#ifdef ALGEBRA_X86_SIMD
+    /*
+     * Explicit kernels for C = 8 and 32 or 64-bit indices. The x entries of a
+     * column of the chunk are fetched with hardware gathers (real types) or with
+     * 128-bit loads of the (re, im) pairs (std::complex<double>).
+     */
+#pragma GCC diagnostic push
+    // the AVX-512 intrinsics of GCC 12 start from _mm512_undefined_pd()
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+    template <typename Index>
+    __attribute__((target("avx2,fma")))
+    void sell_spmv_avx2(std::span<const Index> chunk_ptr, std::span<const Index> idx, std::span<const double> val,
+                        const double* x, double* y, std::size_t begin, std::size_t end) {
+        for (std::size_t c = begin; c < end; ++c) {
+            __m256d acc_lo = _mm256_setzero_pd(), acc_hi = _mm256_setzero_pd();
+            for (std::size_t k = chunk_ptr[c]; k < chunk_ptr[c + 1]; k += 8) {
+                __m256d x_lo, x_hi;
+                if constexpr (sizeof(Index) == 8) {
+                    x_lo = _mm256_i64gather_pd(x, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx.data() + k)), 8);
+                    x_hi = _mm256_i64gather_pd(x, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx.data() + k + 4)), 8);
+                } else {
+                    x_lo = _mm256_i32gather_pd(x, _mm_loadu_si128(reinterpret_cast<const __m128i*>(idx.data() + k)), 8);
+                    x_hi = _mm256_i32gather_pd(x, _mm_loadu_si128(reinterpret_cast<const __m128i*>(idx.data() + k + 4)), 8);
+                }
+                acc_lo = _mm256_fmadd_pd(_mm256_loadu_pd(val.data() + k), x_lo, acc_lo);
+                acc_hi = _mm256_fmadd_pd(_mm256_loadu_pd(val.data() + k + 4), x_hi, acc_hi);
+            }
+            _mm256_storeu_pd(y + c * 8, acc_lo);
+            _mm256_storeu_pd(y + c * 8 + 4, acc_hi);
+        }
+    }
+
+    template <typename Index>
+    __attribute__((target("avx512f")))
+    void sell_spmv_avx512(std::span<const Index> chunk_ptr, std::span<const Index> idx, std::span<const double> val,
+                          const double* x, double* y, std::size_t begin, std::size_t end) {
+        for (std::size_t c = begin; c < end; ++c) {
+            __m512d acc = _mm512_setzero_pd();
+            for (std::size_t k = chunk_ptr[c]; k < chunk_ptr[c + 1]; k += 8) {
+                __m512d xv;
+                if constexpr (sizeof(Index) == 8)
+                    xv = _mm512_i64gather_pd(_mm512_loadu_si512(idx.data() + k), x, 8);
+                else
+                    xv = _mm512_i32gather_pd(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx.data() + k)), x, 8);
+                acc = _mm512_fmadd_pd(_mm512_loadu_pd(val.data() + k), xv, acc);
+            }
+            _mm512_storeu_pd(y + c * 8, acc);
+        }
+    }
+
+    template <typename Index>
+    __attribute__((target("avx2,fma")))
+    inline __m256 gather8_ps(const float* x, const Index* idx) {
+        if constexpr (sizeof(Index) == 8) {
+            const __m128 lo = _mm256_i64gather_ps(x, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx)), 4);
+            const __m128 hi = _mm256_i64gather_ps(x, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx + 4)), 4);
+            return _mm256_set_m128(hi, lo);
+        } else {
+            return _mm256_i32gather_ps(x, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx)), 4);
+        }
+    }
+
+    template <typename Index>
+    __attribute__((target("avx2,fma")))
+    void sell_spmv_avx2(std::span<const Index> chunk_ptr, std::span<const Index> idx, std::span<const float> val,
+                        const float* x, float* y, std::size_t begin, std::size_t end) {
+        for (std::size_t c = begin; c < end; ++c) {
+            __m256 acc = _mm256_setzero_ps();
+            for (std::size_t k = chunk_ptr[c]; k < chunk_ptr[c + 1]; k += 8)
+                acc = _mm256_fmadd_ps(_mm256_loadu_ps(val.data() + k), gather8_ps(x, idx.data() + k), acc);
+            _mm256_storeu_ps(y + c * 8, acc);
+        }
+    }
+
+    // 16 lanes hold two columns of the chunk, the halves are summed at the end
+    template <typename Index>
+    __attribute__((target("avx512f,avx2,fma")))
+    void sell_spmv_avx512(std::span<const Index> chunk_ptr, std::span<const Index> idx, std::span<const float> val,
+                          const float* x, float* y, std::size_t begin, std::size_t end) {
+        for (std::size_t c = begin; c < end; ++c) {
+            __m512 acc = _mm512_setzero_ps();
+            __m256 acc_tail = _mm256_setzero_ps();
+            std::size_t k = chunk_ptr[c];
+            for (; k + 16 <= chunk_ptr[c + 1]; k += 16) {
+                __m512 xv;
+                if constexpr (sizeof(Index) == 8) {
+                    const __m256 lo = _mm512_i64gather_ps(_mm512_loadu_si512(idx.data() + k), x, 4);
+                    const __m256 hi = _mm512_i64gather_ps(_mm512_loadu_si512(idx.data() + k + 8), x, 4);
+                    xv = _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castps_pd(_mm512_castps256_ps512(lo)), _mm256_castps_pd(hi), 1));
+                } else {
+                    xv = _mm512_i32gather_ps(_mm512_loadu_si512(idx.data() + k), x, 4);
+                }
+                acc = _mm512_fmadd_ps(_mm512_loadu_ps(val.data() + k), xv, acc);
+            }
+            if (k < chunk_ptr[c + 1])
+                acc_tail = _mm256_fmadd_ps(_mm256_loadu_ps(val.data() + k), gather8_ps(x, idx.data() + k), acc_tail);
+            const __m256 hi = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(acc), 1));
+            _mm256_storeu_ps(y + c * 8, _mm256_add_ps(_mm256_add_ps(_mm512_castps512_ps256(acc), hi), acc_tail));
+        }
+    }
+
+    /*
+     * std::complex<double> is an array of two doubles. With v = (vr, vi) and
+     * x = (xr, xi) two accumulators collect (vr xr, vi xi) and (vr xi, vi xr),
+     * the real part is then the difference of the first pair and the imaginary
+     * part the sum of the second one.
+     */
+    __attribute__((target("avx2,fma")))
+    inline __m256d complex_reduce(__m256d acc_same, __m256d acc_swap) {
+        return _mm256_blend_pd(_mm256_hsub_pd(acc_same, acc_same), _mm256_hadd_pd(acc_swap, acc_swap), 0b1010);
+    }
+
+    template <typename Index>
+    __attribute__((target("avx2,fma")))
+    void sell_spmv_avx2(std::span<const Index> chunk_ptr, std::span<const Index> idx, std::span<const std::complex<double>> val,
+                        const std::complex<double>* x, std::complex<double>* y, std::size_t begin, std::size_t end) {
+        const double* xd = reinterpret_cast<const double*>(x);
+        for (std::size_t c = begin; c < end; ++c) {
+            __m256d acc_same[4], acc_swap[4];
+            for (int g = 0; g < 4; ++g)
+                acc_same[g] = acc_swap[g] = _mm256_setzero_pd();
+            for (std::size_t k = chunk_ptr[c]; k < chunk_ptr[c + 1]; k += 8) {
+                const double* v = reinterpret_cast<const double*>(val.data() + k);
+                for (int g = 0; g < 4; ++g) {
+                    const __m256d vv = _mm256_loadu_pd(v + 4 * g);
+                    const __m256d xv = _mm256_loadu2_m128d(xd + 2 * idx[k + 2 * g + 1], xd + 2 * idx[k + 2 * g]);
+                    acc_same[g] = _mm256_fmadd_pd(vv, xv, acc_same[g]);
+                    acc_swap[g] = _mm256_fmadd_pd(vv, _mm256_permute_pd(xv, 0b0101), acc_swap[g]);
+                }
+            }
+            double* out = reinterpret_cast<double*>(y + c * 8);
+            for (int g = 0; g < 4; ++g)
+                _mm256_storeu_pd(out + 4 * g, complex_reduce(acc_same[g], acc_swap[g]));
+        }
+    }
+
+    template <typename Index>
+    __attribute__((target("avx512f,avx2,fma")))
+    void sell_spmv_avx512(std::span<const Index> chunk_ptr, std::span<const Index> idx, std::span<const std::complex<double>> val,
+                          const std::complex<double>* x, std::complex<double>* y, std::size_t begin, std::size_t end) {
+        const double* xd = reinterpret_cast<const double*>(x);
+        for (std::size_t c = begin; c < end; ++c) {
+            __m512d acc_same[2], acc_swap[2];
+            for (int g = 0; g < 2; ++g)
+                acc_same[g] = acc_swap[g] = _mm512_setzero_pd();
+            for (std::size_t k = chunk_ptr[c]; k < chunk_ptr[c + 1]; k += 8) {
+                const double* v = reinterpret_cast<const double*>(val.data() + k);
+                for (int g = 0; g < 2; ++g) {
+                    const Index* col = idx.data() + k + 4 * g;
+                    const __m256d lo = _mm256_loadu2_m128d(xd + 2 * col[1], xd + 2 * col[0]);
+                    const __m256d hi = _mm256_loadu2_m128d(xd + 2 * col[3], xd + 2 * col[2]);
+                    const __m512d xv = _mm512_insertf64x4(_mm512_castpd256_pd512(lo), hi, 1);
+                    const __m512d vv = _mm512_loadu_pd(v + 8 * g);
+                    acc_same[g] = _mm512_fmadd_pd(vv, xv, acc_same[g]);
+                    acc_swap[g] = _mm512_fmadd_pd(vv, _mm512_permute_pd(xv, 0x55), acc_swap[g]);
+                }
+            }
+            double* out = reinterpret_cast<double*>(y + c * 8);
+            for (int g = 0; g < 2; ++g) {
+                _mm256_storeu_pd(out + 8 * g, complex_reduce(_mm512_castpd512_pd256(acc_same[g]), _mm512_castpd512_pd256(acc_swap[g])));
+                _mm256_storeu_pd(out + 8 * g + 4, complex_reduce(_mm512_extractf64x4_pd(acc_same[g], 1), _mm512_extractf64x4_pd(acc_swap[g], 1)));
+            }
+        }
+    }
+#pragma GCC diagnostic pop
+#endif
+
+    //! true when sell_spmv has explicit SIMD kernels for T, Index and C
+    template <typename T, typename Index, std::size_t C>
+    inline constexpr bool sell_has_simd =
+#ifdef ALGEBRA_X86_SIMD
+        C == 8 && (sizeof(Index) == 4 || sizeof(Index) == 8) &&
+        (std::is_same_v<T, double> || std::is_same_v<T, float> || std::is_same_v<T, std::complex<double>>);
+#else
+        false;
+#endif
+
+    /**
+     * @brief Highest SimdLevel whose kernels can address the columns of the
+     * matrix: the 32-bit gathers take signed offsets, so with 32-bit indices
+     * a matrix of 2^31 columns or more uses the scalar kernel.
+     */
+    template <typename Index>
+    constexpr SimdLevel sell_simd_limit(std::size_t cols) {
+        return sizeof(Index) == 4 && cols > std::size_t{0x7fffffff} ? SIMD_SCALAR : SIMD_AVX512;
+    }
+
+    //! sell_spmv_scalar, or the explicit kernel of the requested SimdLevel when there is one
+    template <typename T, typename Index, std::size_t C>
+    void sell_spmv(std::span<const Index> chunk_ptr, std::span<const Index> idx, std::span<const T> val,
+                   std::span<const T> x, std::span<T> y, std::size_t begin, std::size_t end, SimdLevel level) {
+#ifdef ALGEBRA_X86_SIMD
+        if constexpr (sell_has_simd<T, Index, C>) {
+            if (level == SIMD_AVX512)
+                return sell_spmv_avx512<Index>(chunk_ptr, idx, val, x.data(), y.data(), begin, end);
+            if (level == SIMD_AVX2)
+                return sell_spmv_avx2<Index>(chunk_ptr, idx, val, x.data(), y.data(), begin, end);
+        }
+#endif
+        sell_spmv_scalar<T, Index, C>(chunk_ptr, idx, val, x, y, begin, end);
+    }
+
+}  // namespace kernels
+}  // namespace algebra
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef SELL_MATRIX_HPP
+#define SELL_MATRIX_HPP
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "Matrix.hpp"
+#include "Parallel.hpp"
+#include "SellKernels.hpp"
+#include "SparseKernels.hpp"
+#include "Utils.hpp"
+
+namespace algebra {
+
+/**
+ * @brief Sliced ELLPACK (SELL-C-sigma) matrix for SIMD matrix-vector products.
+ *
+ * The rows are grouped in chunks of C rows stored column by column, every row
+ * of a chunk padded with zeros to the longest one: the C rows of a chunk are
+ * the C lanes of a vector register. To keep the padding small the rows are
+ * first sorted by decreasing length inside windows of sigma rows, the product
+ * undoes the permutation when writing the result.
+ *
+ * For double, float and std::complex<double> with C = 8 and 32 or 64-bit
+ * indices the product uses explicit AVX2 or AVX-512 kernels, chosen at run
+ * time from the CPU (see set_simd); every other case uses a scalar kernel,
+ * as do 32-bit indices of 2^31 columns or more (the gathers take signed
+ * 32-bit offsets).
+ *
+ * @tparam T Type of the entries.
+ * @tparam C Rows per chunk.
+ * @tparam Index Type of the indices.
+ */
+template <Numeric T, std::size_t C = 8, IndexType Index = std::size_t>
+class SellMatrix {
+    static_assert(C > 0, "The chunk height must be positive");
+
+public:
+    SellMatrix() = default;
+
+    // build from a Matrix in any StorageOrder, compressed or not (a map or
+    // COL_MAJOR matrix goes through a compressed ROW_MAJOR copy).
+    // sigma = 1 keeps the original row order
+    template <StorageOrder order>
+    explicit SellMatrix(const Matrix<T, order, Index>& m, std::size_t sigma = 32 * C) : sigma(std::max<std::size_t>(sigma, 1)) {
+        if constexpr (order == ROW_MAJOR) {
+            if (m.is_fully_compressed()) {
+                build(m);
+            } else {
+                Matrix<T, ROW_MAJOR, Index> m_compressed = m;
+                m_compressed.compress();
+                build(m_compressed);
+            }
+        } else {
+            Matrix<T, COL_MAJOR, Index> m_compressed = m;
+            m_compressed.compress();
+            build(m_compressed.template convert<ROW_MAJOR>());
+        }
+    }
+
+    std::size_t get_rows() const { return rows; }
+    std::size_t get_cols() const { return cols; }
+    std::size_t get_sigma() const { return sigma; }
+    std::size_t get_num_chunks() const { return chunk_ptr.size() - 1; }
+    std::size_t get_num_non_zero() const { return nnz; }
+    // stored entries, padding included
+    std::size_t get_num_stored() const { return values.size(); }
+
+    const std::vector<T>& get_values() const { return values; }
+    const std::vector<Index>& get_chunk_ptr() const { return chunk_ptr; }
+    const std::vector<Index>& get_col_indices() const { return col_indices; }
+    // permutation[p] is the row stored at position p
+    const std::vector<Index>& get_permutation() const { return permutation; }
+
+    void set_num_threads(std::size_t n) { num_threads = n == 0 ? parallel::hardware_threads() : n; }
+    std::size_t get_num_threads() const { return num_threads; }
+
+    // instruction set of the product, capped at the one detected on the CPU
+    // and at the one the kernels can use for the columns (sell_simd_limit)
+    void set_simd(SimdLevel level) {
+        simd = std::min({level, kernels::detect_simd(), kernels::sell_simd_limit<Index>(cols)});
+    }
+    SimdLevel get_simd() const { return simd; }
+
+    friend std::vector<T> operator*(const SellMatrix& m, const std::vector<T>& v) {
+        if (v.size() != m.cols)
+            throw std::invalid_argument("Matrix and vector dimensions do not match for multiplication");
+        // the kernels write whole chunks in the sorted order
+        std::vector<T> sorted(m.get_num_chunks() * C);
+        const auto bounds = kernels::balanced_partition<Index>(m.chunk_ptr, m.num_threads);
+        parallel::run(m.num_threads, [&](std::size_t t) {
+            kernels::sell_spmv<T, Index, C>(m.chunk_ptr, m.col_indices, m.values, v, sorted, bounds[t], bounds[t + 1], m.simd);
+        });
+        std::vector<T> out(m.rows);
+        for (std::size_t p = 0; p < m.rows; ++p)
+            out[m.permutation[p]] = sorted[p];
+        return out;
+    }
+
+private:
+    void build(const Matrix<T, ROW_MAJOR, Index>& m);
+
+    std::size_t rows = 0, cols = 0, nnz = 0;
+    std::size_t sigma = 1;
+    std::size_t num_threads = 1;
+    SimdLevel simd = kernels::detect_simd();
+    std::vector<Index> chunk_ptr{0};  // offset of every chunk in values / col_indices
+    std::vector<Index> col_indices;
+    std::vector<T> values;
+    std::vector<Index> permutation;
+};
+
+// padding entries repeat the last column of their row (column 0 for an empty
+// row), so the kernels only read x entries already used by the row
+template <Numeric T, std::size_t C, IndexType Index>
+void SellMatrix<T, C, Index>::build(const Matrix<T, ROW_MAJOR, Index>& m) {
+    rows = m.get_rows();
+    cols = m.get_cols();
+    nnz = m.get_num_non_zero();
+    simd = std::min(simd, kernels::sell_simd_limit<Index>(cols));
+    const auto& ptr = m.get_row_indices();
+    const auto& idx = m.get_col_indices();
+    const auto& val = m.get_values();
+    auto length = [&](std::size_t i) { return ptr[i + 1] - ptr[i]; };
+
+    permutation.resize(rows);
+    std::iota(permutation.begin(), permutation.end(), Index(0));
+    if (sigma > 1) {
+        for (std::size_t w = 0; w < rows; w += sigma)
+            std::stable_sort(permutation.begin() + w, permutation.begin() + std::min(rows, w + sigma),
+                             [&](Index a, Index b) { return length(a) > length(b); });
+    }
+
+    const std::size_t num_chunks = (rows + C - 1) / C;
+    chunk_ptr.assign(num_chunks + 1, 0);
+    std::size_t stored = 0;
+    for (std::size_t c = 0; c < num_chunks; ++c) {
+        std::size_t width = 0;
+        for (std::size_t p = c * C; p < std::min(rows, (c + 1) * C); ++p)
+            width = std::max<std::size_t>(width, length(permutation[p]));
+        stored += width * C;
+        if (stored > std::numeric_limits<Index>::max())
+            throw std::overflow_error("Too many stored entries for the chosen index type");
+        chunk_ptr[c + 1] = static_cast<Index>(stored);
+    }
+
+    values.assign(stored, T(0));
+    col_indices.assign(stored, 0);
+    for (std::size_t c = 0; c < num_chunks; ++c) {
+        const std::size_t width = (chunk_ptr[c + 1] - chunk_ptr[c]) / C;
+        for (std::size_t r = 0; r < C && c * C + r < rows; ++r) {
+            const std::size_t i = permutation[c * C + r];
+            Index last = 0;
+            for (std::size_t j = 0; j < width; ++j) {
+                const std::size_t dest = chunk_ptr[c] + j * C + r;
+                if (j < length(i)) {
+                    last = idx[ptr[i] + j];
+                    values[dest] = val[ptr[i] + j];
+                }
+                col_indices[dest] = last;
+            }
+        }
+    }
+}
+
+}  // namespace algebra
+
+#endif
@@ -0,0 +1,559 @@
+#ifndef SOLVERS_HPP
+#define SOLVERS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Matrix.hpp"
+#include "MixedMatrix.hpp"
+#include "Parallel.hpp"
+#include "SparseKernels.hpp"
+#include "Utils.hpp"
+#include "chrono.hpp"
+
+namespace algebra {
+
+/**
+ * @brief Krylov solvers for A x = b: CG (hermitian positive definite A),
+ * BiCGSTAB and restarted GMRES (general A), real or complex.
+ *
+ * A solver object owns its workspace, which is allocated by the first solve
+ * and reused by the next ones of the same size. On a compressed ROW_MAJOR
+ * matrix the products run straight on the CSR arrays (with the threads set on
+ * the matrix), fused with the dot products that follow them; any other matrix
+ * goes through Matrix::multiply. The vector updates are fused with the norms
+ * and dot products of their result.
+ *
+ * A preconditioner is any object with a const apply(r, z) writing z = M^-1 r
+ * on spans; CG applies it on the left, BiCGSTAB and GMRES on the right so that
+ * the residual they monitor is the one of the original system.
+ *
+ * A may also be a MixedMatrix<S, T>, whose values are stored in a narrower S:
+ * the products read S and accumulate in T, so the vectors and the residuals
+ * keep the precision of T.
+ */
+namespace solvers {
+
+    // a matrix the solvers accept: Matrix::multiply (y = alpha A x + beta y on
+    // spans of T) and the dimensions
+    template <typename Op, typename T>
+    concept LinearOperator = requires(const Op& A, std::span<const T> x, std::span<T> y) {
+        A.multiply(x, y, T(1), T(0));
+        { A.get_rows() } -> std::convertible_to<std::size_t>;
+        { A.get_cols() } -> std::convertible_to<std::size_t>;
+    };
+
+    struct SolverOptions {
+        std::size_t max_iterations = 1000;
+        double tolerance = 1e-8;      // on the relative residual ||b - A x|| / ||b||
+        std::size_t restart = 30;     // GMRES only
+        bool record_history = true;
+        // called after every iteration with (iteration, relative residual)
+        std::function<void(std::size_t, double)> monitor;
+    };
+
+    struct SolverReport {
+        bool converged = false;
+        std::size_t iterations = 0;
+        double residual = 0;          // final relative residual
+        std::size_t num_spmv = 0;
+        std::size_t num_preconditioner = 0;
+        double wall_time = 0;         // microseconds
+        std::vector<double> residual_history;  // relative residuals, the first one before any iteration
+    };
+
+    template <Numeric T>
+    struct IdentityPreconditioner {
+        void apply(std::span<const T> r, std::span<T> z) const { std::copy(r.begin(), r.end(), z.begin()); }
+    };
+
+    namespace detail {
+
+        template <Numeric T>
+        inline T conj(const T& v) { return kernels::conj_if<true>(v); }
+
+        //! a^H b
+        template <Numeric T>
+        T dot(std::span<const T> a, std::span<const T> b) {
+            T sum = T(0);
+            for (std::size_t i = 0; i < a.size(); ++i)
+                sum += conj(a[i]) * b[i];
+            return sum;
+        }
+
+        template <Numeric T>
+        real_type_t<T> norm(std::span<const T> a) {
+            real_type_t<T> sum = 0;
+            for (const T& v : a)
+                sum += std::norm(v);
+            return std::sqrt(sum);
+        }
+
+        //! y = A x on CSR arrays with values of type V, returning (w^H y, y^H y)
+        template <Numeric T, IndexType Index, typename V>
+        std::pair<T, real_type_t<T>> gather_dot(std::span<const Index> ptr, std::span<const Index> idx, std::span<const V> val,
+                                                std::size_t num_threads, std::span<const T> x, std::span<T> y,
+                                                std::span<const T> w) {
+            const auto bounds = kernels::balanced_partition<Index>(ptr, num_threads);
+            std::vector<std::pair<T, real_type_t<T>>> partial(num_threads);
+            parallel::run(num_threads, [&](std::size_t t) {
+                partial[t] = kernels::spmv_gather_dot<T, Index, V>(ptr, idx, val, x, y, w, bounds[t], bounds[t + 1]);
+            });
+            std::pair<T, real_type_t<T>> out{T(0), 0};
+            for (const auto& [wy, yy] : partial) {
+                out.first += wy;
+                out.second += yy;
+            }
+            return out;
+        }
+
+        //! y = A x, returning (w^H y, y^H y)
+        template <Numeric T, LinearOperator<T> Op>
+        std::pair<T, real_type_t<T>> multiply_dot(const Op& A, std::span<const T> x, std::span<T> y, std::span<const T> w) {
+            A.multiply(x, y);
+            const std::span<const T> y_const(y);
+            const real_type_t<T> y_norm = norm(y_const);
+            return {dot(w, y_const), y_norm * y_norm};
+        }
+
+        template <Numeric T, StorageOrder order, IndexType Index>
+        std::pair<T, real_type_t<T>> multiply_dot(const Matrix<T, order, Index>& A, std::span<const T> x,
+                                                  std::span<T> y, std::span<const T> w) {
+            if constexpr (order == ROW_MAJOR) {
+                if (A.is_fully_compressed())
+                    return gather_dot<T, Index, T>(A.get_row_indices(), A.get_col_indices(), A.get_values(),
+                                                   A.get_num_threads(), x, y, w);
+            }
+            A.multiply(x, y);
+            const std::span<const T> y_const(y);
+            const real_type_t<T> y_norm = norm(y_const);
+            return {dot(w, y_const), y_norm * y_norm};
+        }
+
+        template <Numeric T, StorageType S, IndexType Index>
+        std::pair<T, real_type_t<T>> multiply_dot(const MixedMatrix<S, T, Index>& A, std::span<const T> x,
+                                                  std::span<T> y, std::span<const T> w) {
+            return gather_dot<T, Index, S>(A.get_row_indices(), A.get_col_indices(), A.get_values(), A.get_num_threads(),
+                                           x, y, w);
+        }
+
+        //! r = b - A x, returning ||r||
+        template <Numeric T, LinearOperator<T> Op>
+        real_type_t<T> residual(const Op& A, std::span<const T> b, std::span<const T> x, std::span<T> r) {
+            std::copy(b.begin(), b.end(), r.begin());
+            A.multiply(x, r, T(-1), T(1));
+            return norm(std::span<const T>(r));
+        }
+
+        template <Numeric T, LinearOperator<T> Op>
+        void check_sizes(const Op& A, std::span<const T> b, std::span<const T> x) {
+            if (A.get_rows() != A.get_cols())
+                throw std::invalid_argument("The solvers need a square matrix");
+            if (b.size() != A.get_rows() || x.size() != A.get_cols())
+                throw std::invalid_argument("Vector sizes do not match the matrix dimensions");
+        }
+
+        // records the relative residual of an iteration, true when converged
+        inline bool record(const SolverOptions& options, SolverReport& report, double residual) {
+            report.residual = residual;
+            if (options.record_history)
+                report.residual_history.push_back(residual);
+            if (options.monitor && report.iterations > 0)
+                options.monitor(report.iterations, residual);
+            return residual <= options.tolerance;
+        }
+
+    }  // namespace detail
+
+    /**
+     * @brief Preconditioned conjugate gradient, for hermitian positive definite A.
+     *
+     * One fused product q = A p with p^H q per iteration, the updates of x and r
+     * are fused with ||r||.
+     */
+    template <Numeric T>
+    class ConjugateGradient {
+        static_assert(std::is_floating_point_v<real_type_t<T>>, "The solvers need floating point values");
+
+    public:
+        explicit ConjugateGradient(SolverOptions options = {}) : options(std::move(options)) {}
+
+        template <LinearOperator<T> Op, typename Preconditioner = IdentityPreconditioner<T>>
+        SolverReport solve(const Op& A, std::span<const T> b, std::span<T> x,
+                           const Preconditioner& M = Preconditioner());
+
+        SolverOptions options;
+
+    private:
+        std::vector<T> r, z, p, q;
+    };
+
+    template <Numeric T>
+    template <LinearOperator<T> Op, typename Preconditioner>
+    SolverReport ConjugateGradient<T>::solve(const Op& A, std::span<const T> b, std::span<T> x,
+                                             const Preconditioner& M) {
+        constexpr bool preconditioned = !std::is_same_v<Preconditioner, IdentityPreconditioner<T>>;
+        using Real = real_type_t<T>;
+        detail::check_sizes<T>(A, b, x);
+        Timings::Chrono timer;
+        timer.start();
+        SolverReport report;
+        const std::size_t n = b.size();
+        r.resize(n);
+        p.resize(n);
+        q.resize(n);
+        if constexpr (preconditioned)
+            z.resize(n);
+        // without preconditioner z is r itself
+        const std::span<T> zs = preconditioned ? std::span<T>(z) : std::span<T>(r);
+
+        const Real b_norm = detail::norm(b);
+        if (b_norm == 0) {
+            std::fill(x.begin(), x.end(), T(0));
+            report.converged = true;
+            detail::record(options, report, 0.0);
+            return report;
+        }
+        Real r_norm = detail::residual<T>(A, b, x, r);
+        ++report.num_spmv;
+        report.converged = detail::record(options, report, r_norm / b_norm);
+
+        if constexpr (preconditioned) {
+            M.apply(r, zs);
+            ++report.num_preconditioner;
+        }
+        std::copy(zs.begin(), zs.end(), p.begin());
+        T rz = detail::dot<T>(r, zs);
+
+        while (!report.converged && report.iterations < options.max_iterations) {
+            const T pq = detail::multiply_dot<T>(A, p, q, p).first;
+            ++report.num_spmv;
+            if (pq == T(0))
+                break;  // breakdown: A is not positive definite or p vanished
+            const T alpha = rz / pq;
+            Real rr = 0;
+            for (std::size_t i = 0; i < n; ++i) {
+                x[i] += alpha * p[i];
+                r[i] -= alpha * q[i];
+                rr += std::norm(r[i]);
+            }
+            ++report.iterations;
+            report.converged = detail::record(options, report, std::sqrt(rr) / b_norm);
+            if (report.converged)
+                break;
+
+            T rz_new;
+            if constexpr (preconditioned) {
+                M.apply(r, zs);
+                ++report.num_preconditioner;
+                rz_new = detail::dot<T>(r, zs);
+            } else {
+                rz_new = rr;
+            }
+            const T beta = rz_new / rz;
+            rz = rz_new;
+            for (std::size_t i = 0; i < n; ++i)
+                p[i] = zs[i] + beta * p[i];
+        }
+        timer.stop();
+        report.wall_time = timer.wallTime();
+        return report;
+    }
+
+    /**
+     * @brief Right preconditioned BiCGSTAB, for general A.
+     *
+     * The two products per iteration are fused with r_hat^H v and with
+     * (s^H t, ||t||), the update of r with ||r|| and the next r_hat^H r.
+     */
+    template <Numeric T>
+    class BiCGSTAB {
+        static_assert(std::is_floating_point_v<real_type_t<T>>, "The solvers need floating point values");
+
+    public:
+        explicit BiCGSTAB(SolverOptions options = {}) : options(std::move(options)) {}
+
+        template <LinearOperator<T> Op, typename Preconditioner = IdentityPreconditioner<T>>
+        SolverReport solve(const Op& A, std::span<const T> b, std::span<T> x,
+                           const Preconditioner& M = Preconditioner());
+
+        SolverOptions options;
+
+    private:
+        std::vector<T> r, r_hat, p, v, s, t, p_hat, s_hat;
+    };
+
+    template <Numeric T>
+    template <LinearOperator<T> Op, typename Preconditioner>
+    SolverReport BiCGSTAB<T>::solve(const Op& A, std::span<const T> b, std::span<T> x,
+                                    const Preconditioner& M) {
+        constexpr bool preconditioned = !std::is_same_v<Preconditioner, IdentityPreconditioner<T>>;
+        using Real = real_type_t<T>;
+        detail::check_sizes<T>(A, b, x);
+        Timings::Chrono timer;
+        timer.start();
+        SolverReport report;
+        const std::size_t n = b.size();
+        for (auto* w : {&r, &r_hat, &p, &v, &s, &t})
+            w->assign(n, T(0));
+        if constexpr (preconditioned) {
+            p_hat.resize(n);
+            s_hat.resize(n);
+        }
+        // without preconditioner p_hat and s_hat are p and s
+        const std::span<T> ph = preconditioned ? std::span<T>(p_hat) : std::span<T>(p);
+        const std::span<T> sh = preconditioned ? std::span<T>(s_hat) : std::span<T>(s);
+
+        const Real b_norm = detail::norm(b);
+        if (b_norm == 0) {
+            std::fill(x.begin(), x.end(), T(0));
+            report.converged = true;
+            detail::record(options, report, 0.0);
+            return report;
+        }
+        const Real r_norm = detail::residual<T>(A, b, x, r);
+        ++report.num_spmv;
+        report.converged = detail::record(options, report, r_norm / b_norm);
+        std::copy(r.begin(), r.end(), r_hat.begin());
+
+        T rho = T(1), alpha = T(1), omega = T(1);
+        T rho_new = T(r_norm * r_norm);
+        while (!report.converged && report.iterations < options.max_iterations) {
+            if (rho_new == T(0))
+                break;  // breakdown: r is orthogonal to r_hat
+            const T beta = (rho_new / rho) * (alpha / omega);
+            rho = rho_new;
+            for (std::size_t i = 0; i < n; ++i)
+                p[i] = r[i] + beta * (p[i] - omega * v[i]);
+            if constexpr (preconditioned) {
+                M.apply(p, ph);
+                ++report.num_preconditioner;
+            }
+
+            const T r_hat_v = detail::multiply_dot<T>(A, ph, v, r_hat).first;
+            ++report.num_spmv;
+            if (r_hat_v == T(0))
+                break;
+            alpha = rho / r_hat_v;
+            Real ss = 0;
+            for (std::size_t i = 0; i < n; ++i) {
+                s[i] = r[i] - alpha * v[i];
+                ss += std::norm(s[i]);
+            }
+            ++report.iterations;
+            if (std::sqrt(ss) / b_norm <= options.tolerance) {
+                for (std::size_t i = 0; i < n; ++i)
+                    x[i] += alpha * ph[i];
+                report.converged = detail::record(options, report, std::sqrt(ss) / b_norm);
+                break;
+            }
+
+            if constexpr (preconditioned) {
+                M.apply(s, sh);
+                ++report.num_preconditioner;
+            }
+            const auto [s_t, t_t] = detail::multiply_dot<T>(A, sh, t, s);
+            ++report.num_spmv;
+            if (t_t == 0)
+                break;
+            omega = detail::conj(s_t) / t_t;
+            Real rr = 0;
+            rho_new = T(0);
+            for (std::size_t i = 0; i < n; ++i) {
+                x[i] += alpha * ph[i] + omega * sh[i];
+                r[i] = s[i] - omega * t[i];
+                rr += std::norm(r[i]);
+                rho_new += detail::conj(r_hat[i]) * r[i];
+            }
+            report.converged = detail::record(options, report, std::sqrt(rr) / b_norm);
+            if (omega == T(0))
+                break;
+        }
+        timer.stop();
+        report.wall_time = timer.wallTime();
+        return report;
+    }
+
+    /**
+     * @brief Right preconditioned GMRES restarted every options.restart
+     * iterations, for general A.
+     *
+     * Arnoldi with modified Gram-Schmidt: the product is fused with the first
+     * projection and every subtraction with the next projection (the last one
+     * with the norm of the new basis vector). The least squares problem is
+     * updated with Givens rotations, whose last entry is the residual estimate.
+     * At the end the true residual is computed once more.
+     */
+    template <Numeric T>
+    class GMRES {
+        static_assert(std::is_floating_point_v<real_type_t<T>>, "The solvers need floating point values");
+
+    public:
+        explicit GMRES(SolverOptions options = {}) : options(std::move(options)) {}
+
+        template <LinearOperator<T> Op, typename Preconditioner = IdentityPreconditioner<T>>
+        SolverReport solve(const Op& A, std::span<const T> b, std::span<T> x,
+                           const Preconditioner& M = Preconditioner());
+
+        SolverOptions options;
+
+    private:
+        std::vector<T> basis;              // (restart + 1) vectors of size n
+        std::vector<T> hessenberg;         // column-major, restart + 1 rows
+        std::vector<real_type_t<T>> cs;    // Givens rotations
+        std::vector<T> sn, g, y, w, z;
+    };
+
+    template <Numeric T>
+    template <LinearOperator<T> Op, typename Preconditioner>
+    SolverReport GMRES<T>::solve(const Op& A, std::span<const T> b, std::span<T> x,
+                                 const Preconditioner& M) {
+        constexpr bool preconditioned = !std::is_same_v<Preconditioner, IdentityPreconditioner<T>>;
+        using Real = real_type_t<T>;
+        detail::check_sizes<T>(A, b, x);
+        Timings::Chrono timer;
+        timer.start();
+        SolverReport report;
+        const std::size_t n = b.size();
+        const std::size_t m = std::max<std::size_t>(options.restart, 1);
+        basis.resize((m + 1) * n);
+        hessenberg.resize((m + 1) * m);
+        cs.resize(m);
+        sn.resize(m);
+        g.resize(m + 1);
+        y.resize(m);
+        w.resize(n);
+        z.resize(n);
+        auto V = [&](std::size_t j) { return std::span<T>(basis.data() + j * n, n); };
+        auto H = [&](std::size_t i, std::size_t j) -> T& { return hessenberg[j * (m + 1) + i]; };
+
+        const Real b_norm = detail::norm(b);
+        if (b_norm == 0) {
+            std::fill(x.begin(), x.end(), T(0));
+            report.converged = true;
+            detail::record(options, report, 0.0);
+            return report;
+        }
+        Real beta = detail::residual<T>(A, b, x, V(0));
+        ++report.num_spmv;
+        report.converged = detail::record(options, report, beta / b_norm);
+
+        while (!report.converged && report.iterations < options.max_iterations) {
+            for (std::size_t i = 0; i < n; ++i)
+                V(0)[i] /= beta;
+            std::fill(g.begin(), g.end(), T(0));
+            g[0] = beta;
+
+            std::size_t k = 0;  // columns of the current cycle
+            bool breakdown = false;
+            while (k < m && report.iterations < options.max_iterations) {
+                const std::size_t j = k;
+                std::span<const T> vj = V(j);
+                if constexpr (preconditioned) {
+                    M.apply(vj, z);
+                    ++report.num_preconditioner;
+                    vj = z;
+                }
+                H(0, j) = detail::multiply_dot<T>(A, vj, w, V(0)).first;
+                ++report.num_spmv;
+                for (std::size_t i = 1; i <= j; ++i) {
+                    const T h = H(i - 1, j);
+                    const std::span<const T> prev = V(i - 1), vi = V(i);
+                    T proj = T(0);
+                    for (std::size_t l = 0; l < n; ++l) {
+                        w[l] -= h * prev[l];
+                        proj += detail::conj(vi[l]) * w[l];
+                    }
+                    H(i, j) = proj;
+                }
+                Real ww = 0;
+                {
+                    const T h = H(j, j);
+                    const std::span<const T> last = V(j);
+                    for (std::size_t l = 0; l < n; ++l) {
+                        w[l] -= h * last[l];
+                        ww += std::norm(w[l]);
+                    }
+                }
+                const Real h_next = std::sqrt(ww);
+                H(j + 1, j) = h_next;
+                breakdown = h_next == 0;
+                if (!breakdown) {
+                    const std::span<T> next = V(j + 1);
+                    for (std::size_t l = 0; l < n; ++l)
+                        next[l] = w[l] / h_next;
+                }
+
+                // previous rotations on the new column, then the one that zeroes H(j + 1, j)
+                for (std::size_t i = 0; i < j; ++i) {
+                    const T a = H(i, j), c = H(i + 1, j);
+                    H(i, j) = cs[i] * a + sn[i] * c;
+                    H(i + 1, j) = -detail::conj(sn[i]) * a + cs[i] * c;
+                }
+                const T a = H(j, j);
+                const Real denom = std::sqrt(std::norm(a) + h_next * h_next);
+                if (std::abs(a) == 0) {
+                    cs[j] = 0;
+                    sn[j] = T(1);
+                } else {
+                    cs[j] = std::abs(a) / denom;
+                    sn[j] = (a / std::abs(a)) * (h_next / denom);
+                }
+                H(j, j) = cs[j] * a + sn[j] * T(h_next);
+                H(j + 1, j) = T(0);
+                g[j + 1] = -detail::conj(sn[j]) * g[j];
+                g[j] = cs[j] * g[j];
+
+                ++k;
+                ++report.iterations;
+                report.converged = detail::record(options, report, std::abs(g[j + 1]) / b_norm);
+                if (report.converged || breakdown)
+                    break;
+            }
+
+            // x += M^-1 V y, with H y = g upper triangular
+            for (std::size_t i = k; i-- > 0;) {
+                T sum = g[i];
+                for (std::size_t l = i + 1; l < k; ++l)
+                    sum -= H(i, l) * y[l];
+                y[i] = sum / H(i, i);
+            }
+            std::fill(w.begin(), w.end(), T(0));
+            for (std::size_t i = 0; i < k; ++i) {
+                const std::span<const T> vi = V(i);
+                for (std::size_t l = 0; l < n; ++l)
+                    w[l] += y[i] * vi[l];
+            }
+            if constexpr (preconditioned) {
+                M.apply(w, z);
+                ++report.num_preconditioner;
+                for (std::size_t l = 0; l < n; ++l)
+                    x[l] += z[l];
+            } else {
+                for (std::size_t l = 0; l < n; ++l)
+                    x[l] += w[l];
+            }
+
+            // restart from the true residual
+            beta = detail::residual<T>(A, b, x, V(0));
+            ++report.num_spmv;
+            report.residual = beta / b_norm;
+            report.converged = report.residual <= options.tolerance;
+            if (beta == 0 || (breakdown && !report.converged))
+                break;
+        }
+        timer.stop();
+        report.wall_time = timer.wallTime();
+        return report;
+    }
+
+}  // namespace solvers
+}  // namespace algebra
+
+#endif
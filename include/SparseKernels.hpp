@@ -0,0 +1,667 @@
+#ifndef SPARSE_KERNELS_HPP
+#define SPARSE_KERNELS_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "Parallel.hpp"
+#include "Utils.hpp"
+
+namespace algebra {
+
+/**
+ * @brief Kernels working directly on compressed arrays.
+ *
+ * A compressed matrix is described by an "outer" pointer array (row_indices for
+ * CSR, col_indices for CSC) of size n_outer + 1, an "inner" index array and the
+ * values. Every kernel is written once for this generic layout, the Matrix class
+ * decides which of its arrays plays which role.
+ */
+namespace kernels {
+
+    /**
+     * @brief Split the outer lines of a compressed matrix in num_parts ranges
+     * holding (roughly) the same number of nonzeros.
+     *
+     * Returns num_parts + 1 boundaries: part t owns the lines [b[t], b[t+1]).
+     * A binary search on the pointer array is enough, so the cost is
+     * O(num_parts log n) and skewed lines never end up stalling a single part.
+     */
+    template <typename Index>
+    std::vector<std::size_t> balanced_partition(std::span<const Index> ptr, std::size_t num_parts) {
+        const std::size_t n_outer = ptr.size() - 1;
+        const std::size_t nnz = ptr[n_outer];
+        std::vector<std::size_t> bounds(num_parts + 1, n_outer);
+        bounds[0] = 0;
+        for (std::size_t t = 1; t < num_parts; ++t) {
+            const std::size_t target = nnz * t / num_parts;
+            const std::size_t line = std::lower_bound(ptr.begin(), ptr.end(), target) - ptr.begin();
+            bounds[t] = std::clamp(line, bounds[t - 1], n_outer);
+        }
+        return bounds;
+    }
+
+    /**
+     * @brief Transpose a compressed layout with a counting sort, O(nnz + n).
+     *
+     * Given the arrays of a CSR matrix it returns the CSC arrays of the same
+     * matrix (and vice versa). The inner indices of the output are sorted.
+     *
+     * With more threads the outer lines are split by nonzero count: every
+     * thread counts the inner indices of its lines, the counts are turned into
+     * per-thread offsets (so thread t writes after threads < t in every output
+     * line, keeping it sorted) and every thread scatters its own lines.
+     */
+    template <typename T, typename Index>
+    void transpose(std::size_t n_outer, std::size_t n_inner,
+                   std::span<const Index> ptr, std::span<const Index> idx, std::span<const T> val,
+                   std::vector<Index>& t_ptr, std::vector<Index>& t_idx, std::vector<T>& t_val,
+                   std::size_t num_threads = 1) {
+        const std::size_t nnz = val.size();
+        t_ptr.assign(n_inner + 1, 0);
+        t_idx.resize(nnz);
+        t_val.resize(nnz);
+
+        if (num_threads <= 1) {
+            // count the entries of every inner index, then exclusive scan
+            for (std::size_t k = 0; k < nnz; ++k)
+                ++t_ptr[idx[k] + 1];
+            for (std::size_t j = 0; j < n_inner; ++j)
+                t_ptr[j + 1] += t_ptr[j];
+
+            std::vector<Index> next(t_ptr.begin(), t_ptr.end() - 1);
+            for (std::size_t i = 0; i < n_outer; ++i) {
+                for (std::size_t k = ptr[i]; k < ptr[i + 1]; ++k) {
+                    const Index dest = next[idx[k]]++;
+                    t_idx[dest] = static_cast<Index>(i);
+                    t_val[dest] = val[k];
+                }
+            }
+            return;
+        }
+
+        const auto bounds = balanced_partition<Index>(ptr, num_threads);
+        std::vector<std::vector<Index>> offsets(num_threads, std::vector<Index>(n_inner, 0));
+        parallel::run(num_threads, [&](std::size_t t) {
+            for (std::size_t k = ptr[bounds[t]]; k < ptr[bounds[t + 1]]; ++k)
+                ++offsets[t][idx[k]];
+        });
+
+        // per inner index: line length and offsets relative to the line start
+        parallel::run(num_threads, [&](std::size_t t) {
+            const std::size_t begin = n_inner * t / num_threads, end = n_inner * (t + 1) / num_threads;
+            for (std::size_t j = begin; j < end; ++j) {
+                Index running = 0;
+                for (std::size_t p = 0; p < num_threads; ++p) {
+                    const Index count = offsets[p][j];
+                    offsets[p][j] = running;
+                    running += count;
+                }
+                t_ptr[j + 1] = running;
+            }
+        });
+        for (std::size_t j = 0; j < n_inner; ++j)
+            t_ptr[j + 1] += t_ptr[j];
+
+        parallel::run(num_threads, [&](std::size_t t) {
+            auto& next = offsets[t];
+            for (std::size_t i = bounds[t]; i < bounds[t + 1]; ++i) {
+                for (std::size_t k = ptr[i]; k < ptr[i + 1]; ++k) {
+                    const Index dest = t_ptr[idx[k]] + next[idx[k]]++;
+                    t_idx[dest] = static_cast<Index>(i);
+                    t_val[dest] = val[k];
+                }
+            }
+        });
+    }
+
+    /**
+     * @brief Counting sort of (outer, inner, value) triplets into compressed
+     * lines, O(nnz + n). Inside a line the input order is preserved.
+     */
+    template <typename T, typename Index>
+    void triplets_to_lines(std::size_t n_outer, std::span<const std::size_t> outer, std::span<const std::size_t> inner,
+                           std::span<const T> val, std::vector<Index>& ptr, std::vector<Index>& idx, std::vector<T>& out_val) {
+        const std::size_t nnz = val.size();
+        ptr.assign(n_outer + 1, 0);
+        idx.resize(nnz);
+        out_val.resize(nnz);
+        for (std::size_t k = 0; k < nnz; ++k)
+            ++ptr[outer[k] + 1];
+        for (std::size_t i = 0; i < n_outer; ++i)
+            ptr[i + 1] += ptr[i];
+
+        std::vector<Index> next(ptr.begin(), ptr.end() - 1);
+        for (std::size_t k = 0; k < nnz; ++k) {
+            const Index dest = next[outer[k]]++;
+            idx[dest] = static_cast<Index>(inner[k]);
+            out_val[dest] = val[k];
+        }
+    }
+
+    /**
+     * @brief Sort the lines [begin, end) by inner index (stable, so repeated
+     * entries keep their relative order). Lines already sorted are skipped.
+     *
+     * @return the number of repeated entries found
+     */
+    template <typename T, typename Index>
+    std::size_t sort_lines(std::span<const Index> ptr, std::span<Index> idx, std::span<T> val,
+                           std::size_t begin, std::size_t end) {
+        std::size_t duplicates = 0;
+        std::vector<std::pair<Index, T>> line;
+        for (std::size_t i = begin; i < end; ++i) {
+            const auto first = idx.begin() + ptr[i], last = idx.begin() + ptr[i + 1];
+            if (!std::is_sorted(first, last)) {
+                line.clear();
+                for (std::size_t k = ptr[i]; k < ptr[i + 1]; ++k)
+                    line.emplace_back(idx[k], val[k]);
+                std::stable_sort(line.begin(), line.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+                for (std::size_t k = 0; k < line.size(); ++k) {
+                    idx[ptr[i] + k] = line[k].first;
+                    val[ptr[i] + k] = line[k].second;
+                }
+            }
+            for (std::size_t k = ptr[i] + 1; k < ptr[i + 1]; ++k)
+                duplicates += idx[k] == idx[k - 1];
+        }
+        return duplicates;
+    }
+
+    /**
+     * @brief Merge the repeated inner indices of every (sorted) line in place,
+     * combine(kept, next) gives the merged value. ptr, idx and val shrink.
+     */
+    template <typename T, typename Index, typename Combine>
+    void combine_duplicates(std::vector<Index>& ptr, std::vector<Index>& idx, std::vector<T>& val, Combine combine) {
+        const std::size_t n_outer = ptr.size() - 1;
+        std::size_t pos = 0;
+        std::size_t line_begin = 0;
+        for (std::size_t i = 0; i < n_outer; ++i) {
+            const std::size_t line_end = ptr[i + 1];
+            ptr[i] = static_cast<Index>(pos);
+            for (std::size_t k = line_begin; k < line_end; ++k) {
+                if (pos > ptr[i] && idx[pos - 1] == idx[k]) {
+                    val[pos - 1] = combine(val[pos - 1], val[k]);
+                } else {
+                    idx[pos] = idx[k];
+                    val[pos] = val[k];
+                    ++pos;
+                }
+            }
+            line_begin = line_end;
+        }
+        ptr[n_outer] = static_cast<Index>(pos);
+        idx.resize(pos);
+        val.resize(pos);
+    }
+
+    /**
+     * @brief Position of target in the sorted inner indices idx[begin, end),
+     * or end when it is not stored. Binary search, O(log(end - begin)).
+     */
+    template <typename Index>
+    std::size_t find_in_line(std::span<const Index> idx, std::size_t begin, std::size_t end, std::size_t target) {
+        const auto last = idx.begin() + end;
+        const auto it = std::lower_bound(idx.begin() + begin, last, target);
+        return it != last && *it == target ? static_cast<std::size_t>(it - idx.begin()) : end;
+    }
+
+    /**
+     * @brief First position in the sorted idx[begin, end) whose index is not
+     * below target (galloping search).
+     *
+     * The positions begin + 1, begin + 2, begin + 4, ... are probed until one
+     * reaches target, then the last gap is searched: O(log d) for a target d
+     * entries after begin, so a run of increasing queries in a line costs
+     * about as much as a single pass over it.
+     */
+    template <typename Index>
+    std::size_t gallop(std::span<const Index> idx, std::size_t begin, std::size_t end, std::size_t target) {
+        if (begin == end || idx[begin] >= target)
+            return begin;
+        // idx[low] < target from here on
+        std::size_t low = begin, step = 1, high = end;
+        while (low + step < end) {
+            if (idx[low + step] >= target) {
+                high = low + step;
+                break;
+            }
+            low += step;
+            step *= 2;
+        }
+        return std::lower_bound(idx.begin() + low + 1, idx.begin() + high, target) - idx.begin();
+    }
+
+    //! complex conjugate if requested (and meaningful for T)
+    template <bool conjugate, typename T>
+    inline T conj_if(const T& v) {
+        if constexpr (conjugate && is_complex_v<T>)
+            return std::conj(v);
+        else
+            return v;
+    }
+
+    /**
+     * @brief y[i] += line i times x, for the lines [begin, end) (gather).
+     *
+     * On CSR arrays this is A x, on CSC arrays A^T x (A^H x with conjugate).
+     */
+    template <typename T, typename Index, bool conjugate = false>
+    void spmv_gather(std::span<const Index> ptr, std::span<const Index> idx, std::span<const T> val,
+                     std::span<const T> x, std::span<T> y, std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            for (std::size_t j = ptr[i]; j < ptr[i + 1]; ++j) {
+                y[i] += x[idx[j]] * conj_if<conjugate>(val[j]);
+            }
+        }
+    }
+
+    /**
+     * @brief y += line j times x[j], for the lines [begin, end) (scatter).
+     *
+     * On CSC arrays this is A x, on CSR arrays A^T x (A^H x with conjugate).
+     */
+    template <typename T, typename Index, bool conjugate = false>
+    void spmv_scatter(std::span<const Index> ptr, std::span<const Index> idx, std::span<const T> val,
+                      std::span<const T> x, std::span<T> y, std::size_t begin, std::size_t end) {
+        for (std::size_t j = begin; j < end; ++j) {
+            for (std::size_t k = ptr[j]; k < ptr[j + 1]; ++k) {
+                y[idx[k]] += x[j] * conj_if<conjugate>(val[k]);
+            }
+        }
+    }
+
+    /**
+     * @brief y[i] = alpha * (line i times x) + beta * y[i], for the lines [begin, end) (gather).
+     *
+     * The values may be stored in a narrower type V, every one is widened to T
+     * as it is read, so the sums are accumulated in T.
+     */
+    template <typename T, typename Index, typename V = T>
+    void spmv_gather_scaled(std::span<const Index> ptr, std::span<const Index> idx, std::span<const std::type_identity_t<V>> val,
+                            std::span<const T> x, std::span<T> y, T alpha, T beta, std::size_t begin, std::size_t end) {
+        const bool overwrite = beta == T(0);  // y may hold garbage, as in BLAS
+        for (std::size_t i = begin; i < end; ++i) {
+            T sum = T(0);
+            for (std::size_t j = ptr[i]; j < ptr[i + 1]; ++j) {
+                sum += x[idx[j]] * static_cast<T>(val[j]);
+            }
+            y[i] = overwrite ? alpha * sum : alpha * sum + beta * y[i];
+        }
+    }
+
+    /**
+     * @brief y[i] = line i times x for the lines [begin, end) (gather), fused
+     * with the dot products the Krylov solvers need on the new entries.
+     *
+     * The values may be stored in a narrower type V, as in spmv_gather_scaled.
+     *
+     * @return (w^H y, y^H y) restricted to [begin, end)
+     */
+    template <typename T, typename Index, typename V = T>
+    std::pair<T, real_type_t<T>> spmv_gather_dot(std::span<const Index> ptr, std::span<const Index> idx,
+                                                 std::span<const std::type_identity_t<V>> val,
+                                                 std::span<const T> x, std::span<T> y, std::span<const T> w,
+                                                 std::size_t begin, std::size_t end) {
+        T wy = T(0);
+        real_type_t<T> yy = 0;
+        for (std::size_t i = begin; i < end; ++i) {
+            T sum = T(0);
+            for (std::size_t j = ptr[i]; j < ptr[i + 1]; ++j) {
+                sum += x[idx[j]] * static_cast<T>(val[j]);
+            }
+            y[i] = sum;
+            wy += conj_if<true>(w[i]) * sum;
+            yy += std::norm(sum);
+        }
+        return {wy, yy};
+    }
+
+    //! y += alpha * line j times x[j], for the lines [begin, end) (scatter); y must be scaled by beta beforehand
+    template <typename T, typename Index>
+    void spmv_scatter_scaled(std::span<const Index> ptr, std::span<const Index> idx, std::span<const T> val,
+                             std::span<const T> x, std::span<T> y, T alpha, std::size_t begin, std::size_t end) {
+        for (std::size_t j = begin; j < end; ++j) {
+            const T ax = alpha * x[j];
+            for (std::size_t k = ptr[j]; k < ptr[j + 1]; ++k) {
+                y[idx[k]] += ax * val[k];
+            }
+        }
+    }
+
+    /**
+     * @brief Y = rows [begin, end) of A times the dense block X (gather, CSR).
+     *
+     * X has k columns and is stored row-major (x[r * k + c]) or column-major
+     * (x[c * x_rows + r]), Y in the same layout. Every nonzero is read once and
+     * updates k accumulators, which are summed in the same order as spmv_gather
+     * so each column of Y equals the product with the corresponding vector.
+     */
+    template <typename T, typename Index, bool row_major_block>
+    void spmm_gather(std::span<const Index> ptr, std::span<const Index> idx, std::span<const T> val,
+                     std::span<const T> x, std::size_t x_rows, std::span<T> y, std::size_t y_rows, std::size_t k,
+                     std::size_t begin, std::size_t end) {
+        std::vector<T> acc(k);
+        for (std::size_t i = begin; i < end; ++i) {
+            std::fill(acc.begin(), acc.end(), T());
+            for (std::size_t j = ptr[i]; j < ptr[i + 1]; ++j) {
+                const T v = val[j];
+                const std::size_t col = idx[j];
+                if constexpr (row_major_block) {
+                    const T* x_row = x.data() + col * k;
+                    for (std::size_t c = 0; c < k; ++c)
+                        acc[c] += x_row[c] * v;
+                } else {
+                    for (std::size_t c = 0; c < k; ++c)
+                        acc[c] += x[c * x_rows + col] * v;
+                }
+            }
+            for (std::size_t c = 0; c < k; ++c) {
+                if constexpr (row_major_block)
+                    y[i * k + c] = acc[c];
+                else
+                    y[c * y_rows + i] = acc[c];
+            }
+        }
+    }
+
+    //! Y += columns [begin, end) of A times the matching rows of X (scatter, CSC), layouts as in spmm_gather
+    template <typename T, typename Index, bool row_major_block>
+    void spmm_scatter(std::span<const Index> ptr, std::span<const Index> idx, std::span<const T> val,
+                      std::span<const T> x, std::size_t x_rows, std::span<T> y, std::size_t y_rows, std::size_t k,
+                      std::size_t begin, std::size_t end) {
+        for (std::size_t j = begin; j < end; ++j) {
+            for (std::size_t p = ptr[j]; p < ptr[j + 1]; ++p) {
+                const T v = val[p];
+                const std::size_t row = idx[p];
+                if constexpr (row_major_block) {
+                    const T* x_row = x.data() + j * k;
+                    T* y_row = y.data() + row * k;
+                    for (std::size_t c = 0; c < k; ++c)
+                        y_row[c] += x_row[c] * v;
+                } else {
+                    for (std::size_t c = 0; c < k; ++c)
+                        y[c * y_rows + row] += x[c * x_rows + j] * v;
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief y[block i] += block row i times x, for the block rows [begin, end).
+     *
+     * Block compressed (BSR) layout: ptr / idx index B x B blocks, stored
+     * row-major one after the other in val (val[k * B * B + r * B + c]). B is
+     * known at compile time, so the two loops over a block are fully unrolled
+     * and the B accumulators live in registers.
+     */
+    template <typename T, typename Index, std::size_t B>
+    void bsr_spmv_gather(std::span<const Index> ptr, std::span<const Index> idx, std::span<const T> val,
+                         std::span<const T> x, std::span<T> y, std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            std::array<T, B> acc{};
+            for (std::size_t k = ptr[i]; k < ptr[i + 1]; ++k) {
+                const T* block = val.data() + k * B * B;
+                const T* x_block = x.data() + static_cast<std::size_t>(idx[k]) * B;
+                for (std::size_t r = 0; r < B; ++r)
+                    for (std::size_t c = 0; c < B; ++c)
+                        acc[r] += block[r * B + c] * x_block[c];
+            }
+            for (std::size_t r = 0; r < B; ++r)
+                y[i * B + r] += acc[r];
+        }
+    }
+
+    /**
+     * @brief Sums of the absolute values of the block rows [begin, end) of a
+     * BSR layout, by scalar row (row_sums) or scalar column (col_sums, may be
+     * empty). Unrolled per block as bsr_spmv_gather.
+     */
+    template <typename T, typename Index, std::size_t B>
+    void bsr_abs_sums(std::span<const Index> ptr, std::span<const Index> idx, std::span<const T> val,
+                      std::span<T> row_sums, std::span<T> col_sums, std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            std::array<T, B> acc{};
+            for (std::size_t k = ptr[i]; k < ptr[i + 1]; ++k) {
+                const T* block = val.data() + k * B * B;
+                for (std::size_t r = 0; r < B; ++r)
+                    for (std::size_t c = 0; c < B; ++c)
+                        acc[r] += std::abs(block[r * B + c]);
+                if (!col_sums.empty()) {
+                    T* col_block = col_sums.data() + static_cast<std::size_t>(idx[k]) * B;
+                    for (std::size_t r = 0; r < B; ++r)
+                        for (std::size_t c = 0; c < B; ++c)
+                            col_block[c] += std::abs(block[r * B + c]);
+                }
+            }
+            if (!row_sums.empty())
+                for (std::size_t r = 0; r < B; ++r)
+                    row_sums[i * B + r] = acc[r];
+        }
+    }
+
+    /**
+     * @brief y_l = alpha * A_l x_l + beta * y_l for the L matrices of a batch
+     * sharing one CSR pattern, for the rows [begin, end).
+     *
+     * Interleaved layout: the value of entry k in matrix l is val[k * L + l],
+     * and x, y are interleaved the same way (x[j * L + l]). The loops over the
+     * L matrices are innermost and of fixed length, so one vector instruction
+     * works on the same entry of several matrices; every matrix is summed in
+     * the order of spmv_gather_scaled.
+     */
+    template <typename T, typename Index, std::size_t L>
+    void batched_spmv_gather(std::span<const Index> ptr, std::span<const Index> idx, std::span<const T> val,
+                             std::span<const T> x, std::span<T> y, T alpha, T beta, std::size_t begin, std::size_t end) {
+        const bool overwrite = beta == T(0);  // y may hold garbage, as in BLAS
+        for (std::size_t i = begin; i < end; ++i) {
+            std::array<T, L> acc{};
+            for (std::size_t k = ptr[i]; k < ptr[i + 1]; ++k) {
+                const T* v = val.data() + k * L;
+                const T* x_j = x.data() + static_cast<std::size_t>(idx[k]) * L;
+                for (std::size_t l = 0; l < L; ++l)
+                    acc[l] += x_j[l] * v[l];
+            }
+            T* y_i = y.data() + i * L;
+            for (std::size_t l = 0; l < L; ++l)
+                y_i[l] = overwrite ? alpha * acc[l] : alpha * acc[l] + beta * y_i[l];
+        }
+    }
+
+    /**
+     * @brief Level schedule of a sparse triangular solve on CSR arrays.
+     *
+     * diag[i] is the position of the diagonal entry of row i. For the lower
+     * (upper) solve row i depends on the columns before (after) the diagonal:
+     * its level is one more than the deepest of them, so the rows of a level
+     * can be solved at the same time once the previous levels are done. The
+     * rows are returned grouped by level: level l is
+     * rows[level_ptr[l] .. level_ptr[l + 1]).
+     */
+    template <typename Index, bool lower>
+    void level_schedule(std::span<const Index> ptr, std::span<const Index> idx, std::span<const Index> diag,
+                        std::vector<Index>& level_ptr, std::vector<Index>& rows) {
+        const std::size_t n = ptr.size() - 1;
+        std::vector<Index> level(n, 0);
+        std::size_t num_levels = 0;
+        for (std::size_t step = 0; step < n; ++step) {
+            const std::size_t i = lower ? step : n - 1 - step;
+            const std::size_t begin = lower ? ptr[i] : diag[i] + 1, end = lower ? diag[i] : ptr[i + 1];
+            Index l = 0;
+            for (std::size_t k = begin; k < end; ++k)
+                l = std::max<Index>(l, level[idx[k]] + 1);
+            level[i] = l;
+            num_levels = std::max<std::size_t>(num_levels, l + 1);
+        }
+        level_ptr.assign(num_levels + 1, 0);
+        for (std::size_t i = 0; i < n; ++i)
+            ++level_ptr[level[i] + 1];
+        for (std::size_t l = 0; l < num_levels; ++l)
+            level_ptr[l + 1] += level_ptr[l];
+        std::vector<Index> next(level_ptr.begin(), level_ptr.end() - 1);
+        rows.resize(n);
+        for (std::size_t i = 0; i < n; ++i)
+            rows[next[level[i]]++] = static_cast<Index>(i);
+    }
+
+    /**
+     * @brief Rows [begin, end) of a sparse triangular solve on CSR arrays:
+     * x[i] = (b[i] - scale * sum_j a_ij x[j]) * inv_diag[i], j running over the
+     * entries before (lower) or after (upper) the diagonal diag[i].
+     *
+     * An empty inv_diag means a unit diagonal. The rows are taken from order
+     * (a level of a schedule) or, when order is empty, in natural order
+     * (backwards for the upper solve). b may be x itself.
+     */
+    template <typename T, typename Index, bool lower>
+    void sptrsv_rows(std::span<const Index> ptr, std::span<const Index> idx, std::span<const T> val,
+                     std::span<const Index> diag, std::span<const T> inv_diag, T scale,
+                     std::span<const T> b, std::span<T> x, std::span<const Index> order,
+                     std::size_t begin, std::size_t end) {
+        for (std::size_t step = begin; step < end; ++step) {
+            const std::size_t i = !order.empty() ? order[step] : lower ? step : end - 1 - (step - begin);
+            const std::size_t k_begin = lower ? ptr[i] : diag[i] + 1, k_end = lower ? diag[i] : ptr[i + 1];
+            T sum = T(0);
+            for (std::size_t k = k_begin; k < k_end; ++k)
+                sum += val[k] * x[idx[k]];
+            const T xi = b[i] - scale * sum;
+            x[i] = inv_diag.empty() ? xi : xi * inv_diag[i];
+        }
+    }
+
+    /**
+     * @brief y += alpha * A x over the rows [begin, end) of a matrix stored as
+     * its lower triangle in CSR (sorted rows, diagonal included).
+     *
+     * Every stored a_ij is read once: it is gathered into y_i and, for j != i,
+     * its mirror a_ji = mirror(a_ij) is scattered into y_j. The scattered rows
+     * j < begin may belong to other threads, so every thread needs its own y.
+     */
+    template <typename T, typename Index, typename Mirror>
+    void symmetric_spmv(std::span<const Index> ptr, std::span<const Index> idx, std::span<const T> val,
+                        std::span<const T> x, std::span<T> y, T alpha, Mirror mirror,
+                        std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            std::size_t k_end = ptr[i + 1];
+            T sum = T(0);
+            if (k_end > ptr[i] && idx[k_end - 1] == i) {  // the diagonal is the last entry
+                --k_end;
+                sum = val[k_end] * x[i];
+            }
+            const T xi = alpha * x[i];
+            for (std::size_t k = ptr[i]; k < k_end; ++k) {
+                sum += val[k] * x[idx[k]];
+                y[idx[k]] += mirror(val[k]) * xi;
+            }
+            y[i] += alpha * sum;
+        }
+    }
+
+    /**
+     * @brief Row sums of |A| for a matrix stored as its lower triangle in CSR:
+     * |a_ij| = |a_ji|, so they are also the column sums.
+     */
+    template <typename T, typename Index>
+    void symmetric_abs_sums(std::span<const Index> ptr, std::span<const Index> idx, std::span<const T> val,
+                            std::span<T> sums) {
+        for (std::size_t i = 0; i + 1 < ptr.size(); ++i) {
+            for (std::size_t k = ptr[i]; k < ptr[i + 1]; ++k) {
+                const T a = std::abs(val[k]);
+                sums[i] += a;
+                if (idx[k] != i)
+                    sums[idx[k]] += a;
+            }
+        }
+    }
+
+    /**
+     * @brief Symbolic pass of the Gustavson product C = A * B.
+     *
+     * A and B are given in the same compressed layout (n_outer rows of A, B
+     * indexed by the inner indices of A). Only the pattern is visited: a marker
+     * array of size n_inner (the inner dimension of C) counts the distinct
+     * entries of every outer line of C, so that c_ptr is exact before any value
+     * is computed.
+     */
+    template <typename Index>
+    void spgemm_symbolic(std::size_t n_outer, std::size_t n_inner,
+                         std::span<const Index> a_ptr, std::span<const Index> a_idx,
+                         std::span<const Index> b_ptr, std::span<const Index> b_idx,
+                         std::vector<Index>& c_ptr) {
+        constexpr std::size_t unmarked = static_cast<std::size_t>(-1);
+        std::vector<std::size_t> marker(n_inner, unmarked);
+        c_ptr.assign(n_outer + 1, 0);
+
+        for (std::size_t i = 0; i < n_outer; ++i) {
+            std::size_t count = 0;
+            for (std::size_t ka = a_ptr[i]; ka < a_ptr[i + 1]; ++ka) {
+                const std::size_t k = a_idx[ka];
+                for (std::size_t kb = b_ptr[k]; kb < b_ptr[k + 1]; ++kb) {
+                    const std::size_t j = b_idx[kb];
+                    if (marker[j] != i) {
+                        marker[j] = i;
+                        ++count;
+                    }
+                }
+            }
+            const std::size_t line_end = c_ptr[i] + count;
+            if (line_end > std::numeric_limits<Index>::max())
+                throw std::overflow_error("Too many non zeros in the product for the chosen index type");
+            c_ptr[i + 1] = static_cast<Index>(line_end);
+        }
+    }
+
+    /**
+     * @brief Numeric pass of the Gustavson product C = A * B.
+     *
+     * c_ptr must come from spgemm_symbolic. Every outer line is accumulated in a
+     * dense accumulator of size n_inner, the touched inner indices are then
+     * sorted and gathered into c_idx / c_val.
+     */
+    template <typename T, typename Index>
+    void spgemm_numeric(std::size_t n_outer, std::size_t n_inner,
+                        std::span<const Index> a_ptr, std::span<const Index> a_idx, std::span<const T> a_val,
+                        std::span<const Index> b_ptr, std::span<const Index> b_idx, std::span<const T> b_val,
+                        std::span<const Index> c_ptr, std::vector<Index>& c_idx, std::vector<T>& c_val) {
+        constexpr std::size_t unmarked = static_cast<std::size_t>(-1);
+        std::vector<std::size_t> marker(n_inner, unmarked);
+        std::vector<T> accumulator(n_inner, T());
+        c_idx.resize(c_ptr[n_outer]);
+        c_val.resize(c_ptr[n_outer]);
+
+        for (std::size_t i = 0; i < n_outer; ++i) {
+            std::size_t pos = c_ptr[i];
+            for (std::size_t ka = a_ptr[i]; ka < a_ptr[i + 1]; ++ka) {
+                const std::size_t k = a_idx[ka];
+                const T a = a_val[ka];
+                for (std::size_t kb = b_ptr[k]; kb < b_ptr[k + 1]; ++kb) {
+                    const std::size_t j = b_idx[kb];
+                    if (marker[j] != i) {
+                        marker[j] = i;
+                        accumulator[j] = a * b_val[kb];
+                        c_idx[pos++] = static_cast<Index>(j);
+                    } else {
+                        accumulator[j] += a * b_val[kb];
+                    }
+                }
+            }
+            // keep the inner indices sorted, as the rest of the class expects
+            std::sort(c_idx.begin() + c_ptr[i], c_idx.begin() + pos);
+            for (std::size_t k = c_ptr[i]; k < pos; ++k)
+                c_val[k] = accumulator[c_idx[k]];
+        }
+    }
+
+}  // namespace kernels
+}  // namespace algebra
+
+#endif
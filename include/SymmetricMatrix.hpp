@@ -0,0 +1,298 @@
+#ifndef SYMMETRIC_MATRIX_HPP
+#define SYMMETRIC_MATRIX_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "MappedFile.hpp"
+#include "Matrix.hpp"
+#include "MatrixFileConstructor.hpp"
+#include "Parallel.hpp"
+#include "PerfCounters.hpp"
+#include "SparseKernels.hpp"
+#include "Utils.hpp"
+
+namespace algebra {
+
+/**
+ * @brief Symmetric, skew-symmetric or hermitian matrix stored as its lower
+ * triangle and diagonal in CSR.
+ *
+ * The upper entries are implied, a_ji = a_ij, -a_ij or conj(a_ij): the
+ * matrix takes about half the memory of the expanded one and the product
+ * reads every stored entry and index once for both triangles.
+ * operator(), the norms and the products account for the implied entries.
+ *
+ * @tparam T Type of the entries.
+ * @tparam Index Type of the indices.
+ */
+template <Numeric T, IndexType Index = std::size_t>
+class SymmetricMatrix {
+public:
+    SymmetricMatrix() = default;
+
+    // read a Matrix Market file: symmetric, skew-symmetric and hermitian
+    // files are kept as stored (upper entries are moved to the lower
+    // triangle), general files must hold a matrix of the given symmetry
+    explicit SymmetricMatrix(const std::string& file_name, MarketSymmetry symmetry = SYMMETRIC);
+
+    // keep the lower triangle of a square Matrix in any StorageOrder; the
+    // upper triangle must be the exact mirror of the lower one
+    template <StorageOrder order>
+    explicit SymmetricMatrix(const Matrix<T, order, Index>& m, MarketSymmetry symmetry = SYMMETRIC) {
+        if constexpr (order == ROW_MAJOR) {
+            if (m.is_fully_compressed()) {
+                build(m, symmetry);
+            } else {
+                Matrix<T, ROW_MAJOR, Index> m_compressed = m;
+                m_compressed.compress();
+                build(m_compressed, symmetry);
+            }
+        } else {
+            Matrix<T, COL_MAJOR, Index> m_compressed = m;
+            m_compressed.compress();
+            build(m_compressed.template convert<ROW_MAJOR>(), symmetry);
+        }
+    }
+
+    std::size_t get_rows() const { return n; }
+    std::size_t get_cols() const { return n; }
+    MarketSymmetry get_symmetry() const { return symmetry; }
+    // entries of the expanded matrix, and entries actually stored
+    std::size_t get_num_non_zero() const { return 2 * values.size() - num_diagonal; }
+    std::size_t get_num_stored() const { return values.size(); }
+
+    const std::vector<T>& get_values() const { return values; }
+    const std::vector<Index>& get_row_indices() const { return row_indices; }
+    const std::vector<Index>& get_col_indices() const { return col_indices; }
+
+    void set_num_threads(std::size_t n_threads) { num_threads = n_threads == 0 ? parallel::hardware_threads() : n_threads; }
+    std::size_t get_num_threads() const { return num_threads; }
+
+    // element access, upper entries through their mirror
+    T operator()(std::size_t row, std::size_t col) const {
+        if (row >= n || col >= n)
+            throw std::out_of_range("Index out of range");
+        if (row < col)
+            return market::mirror_value((*this)(col, row), symmetry);
+        const auto first = col_indices.begin() + row_indices[row], last = col_indices.begin() + row_indices[row + 1];
+        const auto it = std::lower_bound(first, last, static_cast<Index>(col));
+        return it == last || *it != col ? T(0) : values[it - col_indices.begin()];
+    }
+
+    template <WhichNorm NORM>
+    T norm() const;
+
+    // y = alpha * A x + beta * y
+    void multiply(std::span<const T> x, std::span<T> y, T alpha = T(1), T beta = T(0)) const;
+
+    friend std::vector<T> operator*(const SymmetricMatrix& m, const std::vector<T>& v) {
+        if (v.size() != m.n)
+            throw std::invalid_argument("Matrix and vector dimensions do not match for multiplication");
+        std::vector<T> out(m.n, T(0));
+        m.multiply(v, out);
+        return out;
+    }
+
+    // the full matrix, with the implied entries stored
+    template <StorageOrder order>
+    Matrix<T, order, Index> expand() const;
+
+private:
+    void build(const Matrix<T, ROW_MAJOR, Index>& m, MarketSymmetry symmetry);
+    // lower triangle CSR of (row, col, value) triplets, the last of repeated entries kept
+    void assemble(std::size_t size, const std::vector<std::size_t>& rows, const std::vector<std::size_t>& cols,
+                  const std::vector<T>& vals);
+
+    std::size_t n = 0;
+    MarketSymmetry symmetry = SYMMETRIC;
+    std::size_t num_diagonal = 0;  // stored diagonal entries
+    std::size_t num_threads = 1;
+    std::vector<Index> row_indices;  // n + 1 entries
+    std::vector<Index> col_indices;  // sorted in every row, <= row
+    std::vector<T> values;
+};
+
+template <Numeric T, IndexType Index>
+SymmetricMatrix<T, Index>::SymmetricMatrix(const std::string& file_name, MarketSymmetry symmetry) {
+    MappedFile file(file_name);
+    const std::string_view text = file.view();
+    const MarketHeader header = market::read_header(text);
+    if (header.symmetry == GENERAL) {
+        build(Matrix<T, ROW_MAJOR, Index>(file_name, true), symmetry);
+        return;
+    }
+    if (header.rows != header.cols)
+        throw std::invalid_argument("A symmetric matrix must be square: " + file_name);
+    if constexpr (!is_complex_v<T>) {
+        if (header.field == COMPLEX)
+            throw std::runtime_error("Cannot read a complex Matrix Market file into a real matrix: " + file_name);
+    }
+    ALGEBRA_PERF_REGION("read");
+    this->symmetry = header.symmetry;
+
+    std::vector<std::size_t> rows, cols;
+    std::vector<T> vals;
+    rows.reserve(header.num_entries);
+    cols.reserve(header.num_entries);
+    vals.reserve(header.num_entries);
+    for (const auto& chunk : market::read_triplets<T>(text, header, file_name)) {
+        for (std::size_t k = 0; k < chunk.values.size(); ++k) {
+            const bool upper = chunk.rows[k] < chunk.cols[k];
+            rows.push_back(upper ? chunk.cols[k] : chunk.rows[k]);
+            cols.push_back(upper ? chunk.rows[k] : chunk.cols[k]);
+            vals.push_back(upper ? market::mirror_value(chunk.values[k], header.symmetry) : chunk.values[k]);
+        }
+    }
+    assemble(header.rows, rows, cols, vals);
+}
+
+template <Numeric T, IndexType Index>
+void SymmetricMatrix<T, Index>::assemble(std::size_t size, const std::vector<std::size_t>& rows,
+                                         const std::vector<std::size_t>& cols, const std::vector<T>& vals) {
+    if (vals.size() > std::numeric_limits<Index>::max() || size >= std::numeric_limits<Index>::max())
+        throw std::overflow_error("Matrix too large for the chosen index type");
+    n = size;
+    kernels::triplets_to_lines<T, Index>(n, rows, cols, vals, row_indices, col_indices, values);
+    if (kernels::sort_lines<T, Index>(row_indices, col_indices, values, 0, n) != 0)
+        kernels::combine_duplicates(row_indices, col_indices, values, [](const T&, const T& last) { return last; });
+    num_diagonal = 0;
+    for (std::size_t i = 0; i < n; ++i)
+        num_diagonal += row_indices[i + 1] > row_indices[i] && col_indices[row_indices[i + 1] - 1] == i;
+}
+
+// the strictly upper entries, mirrored, must be exactly the strictly lower ones
+template <Numeric T, IndexType Index>
+void SymmetricMatrix<T, Index>::build(const Matrix<T, ROW_MAJOR, Index>& m, MarketSymmetry symmetry) {
+    if (m.get_rows() != m.get_cols())
+        throw std::invalid_argument("A symmetric matrix must be square");
+    if (symmetry == GENERAL)
+        throw std::invalid_argument("SymmetricMatrix needs a symmetric, skew-symmetric or hermitian matrix");
+    this->symmetry = symmetry;
+    const auto& ptr = m.get_row_indices();
+    const auto& idx = m.get_col_indices();
+    const auto& val = m.get_values();
+
+    std::vector<std::size_t> lower_rows, lower_cols, upper_rows, upper_cols;
+    std::vector<T> lower_vals, upper_vals;
+    for (std::size_t i = 0; i < m.get_rows(); ++i) {
+        for (std::size_t k = ptr[i]; k < ptr[i + 1]; ++k) {
+            if (idx[k] <= i) {
+                lower_rows.push_back(i);
+                lower_cols.push_back(idx[k]);
+                lower_vals.push_back(val[k]);
+            } else {
+                upper_rows.push_back(idx[k]);
+                upper_cols.push_back(i);
+                upper_vals.push_back(market::mirror_value(val[k], symmetry));
+            }
+        }
+    }
+    assemble(m.get_rows(), lower_rows, lower_cols, lower_vals);
+
+    // the mirrored upper triangle, compared with the strictly lower entries
+    std::vector<Index> u_ptr, u_idx;
+    std::vector<T> u_val;
+    kernels::triplets_to_lines<T, Index>(n, upper_rows, upper_cols, upper_vals, u_ptr, u_idx, u_val);
+    kernels::sort_lines<T, Index>(u_ptr, u_idx, u_val, 0, n);
+    bool mirrored = true;
+    for (std::size_t i = 0; mirrored && i < n; ++i) {
+        std::size_t k_end = row_indices[i + 1];
+        if (k_end > row_indices[i] && col_indices[k_end - 1] == i) {
+            mirrored = market::mirror_value(values[k_end - 1], symmetry) == values[k_end - 1];
+            --k_end;
+        }
+        mirrored = mirrored && k_end - row_indices[i] == u_ptr[i + 1] - u_ptr[i] &&
+                   std::equal(col_indices.begin() + row_indices[i], col_indices.begin() + k_end, u_idx.begin() + u_ptr[i]) &&
+                   std::equal(values.begin() + row_indices[i], values.begin() + k_end, u_val.begin() + u_ptr[i]);
+    }
+    if (!mirrored)
+        throw std::invalid_argument("The matrix does not have the requested symmetry");
+}
+
+// ONE and MAX coincide: the row sums of |A| are its column sums
+template <Numeric T, IndexType Index>
+template <WhichNorm NORM>
+T SymmetricMatrix<T, Index>::norm() const {
+    if constexpr (NORM == WhichNorm::FROBENIUS) {
+        double off_diagonal = 0, diagonal = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            for (std::size_t k = row_indices[i]; k < row_indices[i + 1]; ++k) {
+                if (col_indices[k] == i)
+                    diagonal += std::norm(values[k]);
+                else
+                    off_diagonal += std::norm(values[k]);
+            }
+        }
+        return std::sqrt(diagonal + 2 * off_diagonal);
+    } else {
+        std::vector<T> sums(n, T(0));
+        kernels::symmetric_abs_sums<T, Index>(row_indices, col_indices, values, sums);
+        return sums.empty() ? T(0) : *std::max_element(sums.begin(), sums.end(), [](const T& a, const T& b) {
+            return std::norm(a) < std::norm(b);
+        });
+    }
+}
+
+// the rows are split by nonzero count; every thread but the first scatters
+// into its own partial output, which only spans the rows up to its last one
+template <Numeric T, IndexType Index>
+void SymmetricMatrix<T, Index>::multiply(std::span<const T> x, std::span<T> y, T alpha, T beta) const {
+    if (x.size() < n || y.size() < n)
+        throw std::invalid_argument("Vector sizes do not match the matrix dimensions");
+    ALGEBRA_PERF_REGION("spmv");
+    if (beta == T(0))
+        std::fill(y.begin(), y.begin() + n, T(0));
+    else if (beta != T(1))
+        std::for_each(y.begin(), y.begin() + n, [beta](T& yi) { yi *= beta; });
+
+    const MarketSymmetry kind = symmetry;
+    auto run = [&](auto mirror) {
+        const auto bounds = kernels::balanced_partition<Index>(row_indices, num_threads);
+        std::vector<std::vector<T>> partial(num_threads - 1);
+        parallel::run(num_threads, [&](std::size_t t) {
+            std::span<T> out = y;
+            if (t > 0) {
+                partial[t - 1].assign(bounds[t + 1], T(0));
+                out = partial[t - 1];
+            }
+            kernels::symmetric_spmv<T, Index>(row_indices, col_indices, values, x, out, alpha, mirror,
+                                              bounds[t], bounds[t + 1]);
+        });
+        for (const auto& p : partial)
+            for (std::size_t i = 0; i < p.size(); ++i)
+                y[i] += p[i];
+    };
+    if (kind == SKEW_SYMMETRIC)
+        run([](const T& v) { return -v; });
+    else if (kind == HERMITIAN)
+        run([](const T& v) { return kernels::conj_if<true>(v); });
+    else
+        run([](const T& v) { return v; });
+}
+
+template <Numeric T, IndexType Index>
+template <StorageOrder order>
+Matrix<T, order, Index> SymmetricMatrix<T, Index>::expand() const {
+    Matrix<T, order, Index> out(n, n);
+    out.set_assembly(TRIPLET_ASSEMBLY);
+    out.reserve(get_num_non_zero());
+    for (std::size_t i = 0; i < n; ++i) {
+        for (std::size_t k = row_indices[i]; k < row_indices[i + 1]; ++k) {
+            out.add(i, col_indices[k], values[k]);
+            if (col_indices[k] != i)
+                out.add(col_indices[k], i, market::mirror_value(values[k], symmetry));
+        }
+    }
+    out.compress();
+    return out;
+}
+
+}  // namespace algebra
+
+#endif
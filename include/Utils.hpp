@@ -1,21 +1,81 @@
 #ifndef UTILS_HPP
 #define UTILS_HPP
 #include <array>
+#include <complex>
+#include <concepts>
 #include <functional>
 #include <type_traits>
 #include <random>
+#include <vector>
 
+#include "LowPrecision.hpp"
 
 namespace algebra {
 
     template <typename T>
     concept Numeric = std::is_arithmetic_v<T> || std::is_same_v<T, std::complex<float>> || std::is_same_v<T, std::complex<double>>;
 
+    // type of the stored values of a MixedMatrix: a Numeric type or a 16-bit
+    // float, computed on in a wider accumulation type
+    template <typename S>
+    concept StorageType = Numeric<S> || std::is_same_v<S, bfloat16> || std::is_same_v<S, float16>;
+
+    // default accumulation type of a storage type: double for the real ones
+    // narrower than double, std::complex<double> for std::complex<float>
+    template <typename S>
+    struct accumulator_type {
+        using type = S;
+    };
+    template <>
+    struct accumulator_type<float> {
+        using type = double;
+    };
+    template <>
+    struct accumulator_type<bfloat16> {
+        using type = double;
+    };
+    template <>
+    struct accumulator_type<float16> {
+        using type = double;
+    };
+    template <>
+    struct accumulator_type<std::complex<float>> {
+        using type = std::complex<double>;
+    };
+    template <typename S>
+    using accumulator_t = typename accumulator_type<S>::type;
+
+    // type of the indices of the compressed arrays
+    template <typename I>
+    concept IndexType = std::unsigned_integral<I>;
+
+    template <typename T>
+    inline constexpr bool is_complex_v = std::is_same_v<T, std::complex<float>> || std::is_same_v<T, std::complex<double>>;
+
+    // real type underlying T: T itself, or R for std::complex<R>
+    template <typename T>
+    struct real_type {
+        using type = T;
+    };
+    template <typename R>
+    struct real_type<std::complex<R>> {
+        using type = R;
+    };
+    template <typename T>
+    using real_type_t = typename real_type<T>::type;
+
     enum StorageOrder {
         ROW_MAJOR,
         COL_MAJOR
     };
 
+    // store used while the matrix is uncompressed: the ordered map, or an
+    // unordered buffer of (i, j, v) triplets sorted only by compress()
+    enum Assembly {
+        MAP_ASSEMBLY,
+        TRIPLET_ASSEMBLY
+    };
+
     enum WhichNorm {
         FROBENIUS,
         ONE,
@@ -33,6 +93,13 @@ namespace algebra {
         }
     };
 
+    struct KeyHash {
+        std::size_t operator()(const Key& k) const {
+            std::size_t h = std::hash<std::size_t>{}(k[0]);
+            return h ^ (std::hash<std::size_t>{}(k[1]) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+        }
+    };
+
     template <Numeric T, StorageOrder order>
     using Compare = std::conditional_t<order == ROW_MAJOR, std::less<Key>, ColumnMajorCompare>;
     //by default we have the normal std::less<Key> for ROW_MAJOR
@@ -54,7 +121,7 @@ namespace algebra {
                 random_vector[i] = T(real_part, imag_part);
             }
         } else {
-            for (int i = 0; i < size; ++i) {
+            for (std::size_t i = 0; i < size; ++i) {
                 random_vector[i] = dis(gen);
             }
         }
@@ -0,0 +1,219 @@
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "PerfCounters.hpp"
+#include "chrono.hpp"
+
+/**
+ * @brief Small benchmark harness used by bench.cpp.
+ *
+ * An operation is run a few times untimed (warm-up) and then num_runs times,
+ * every run timed on its own; an optional setup, not timed, runs before every
+ * call (e.g. to get back an uncompressed matrix before timing compress). The
+ * samples are summarised by order statistics, which unlike the mean are not
+ * dragged by the occasional preempted run. When built with PERF=1 the perf
+ * regions of the timed runs (not of the warm-up) are kept with the record.
+ */
+namespace bench {
+
+    //! keep the compiler from dropping a result that is never read
+    template <typename V>
+    inline void keep(const V& value) {
+        asm volatile("" : : "r"(&value) : "memory");
+    }
+
+    struct Stats {
+        std::size_t runs = 0;
+        double min = 0, p10 = 0, median = 0, p90 = 0, max = 0, mean = 0;  // micro seconds
+    };
+
+    //! linear interpolation between the closest ranks of the sorted samples
+    inline double percentile(const std::vector<double>& sorted, double p) {
+        if (sorted.empty())
+            return 0;
+        const double rank = p * (sorted.size() - 1);
+        const std::size_t low = static_cast<std::size_t>(rank);
+        const std::size_t high = std::min(low + 1, sorted.size() - 1);
+        return sorted[low] + (rank - low) * (sorted[high] - sorted[low]);
+    }
+
+    inline Stats summarize(std::vector<double> samples) {
+        Stats stats;
+        if (samples.empty())
+            return stats;
+        std::sort(samples.begin(), samples.end());
+        stats.runs = samples.size();
+        stats.min = samples.front();
+        stats.max = samples.back();
+        stats.p10 = percentile(samples, 0.10);
+        stats.median = percentile(samples, 0.50);
+        stats.p90 = percentile(samples, 0.90);
+        double sum = 0;
+        for (double s : samples)
+            sum += s;
+        stats.mean = sum / samples.size();
+        return stats;
+    }
+
+    //! time f() num_runs times after num_warmup untimed calls, setup() before every call
+    template <typename Setup, typename F>
+    Stats measure(int num_warmup, int num_runs, Setup&& setup, F&& f) {
+        Timings::Chrono timer;
+        for (int i = 0; i < num_warmup; ++i) {
+            setup();
+            f();
+        }
+        algebra::perf::reset();
+        std::vector<double> samples;
+        samples.reserve(num_runs);
+        for (int i = 0; i < num_runs; ++i) {
+            setup();
+            timer.start();
+            f();
+            timer.stop();
+            samples.push_back(timer.wallTime());
+        }
+        return summarize(std::move(samples));
+    }
+
+    template <typename F>
+    Stats measure(int num_warmup, int num_runs, F&& f) {
+        return measure(num_warmup, num_runs, [] {}, std::forward<F>(f));
+    }
+
+    //! one line of the report
+    struct Record {
+        std::string matrix, type, order, operation;
+        std::size_t rows = 0, cols = 0, nnz = 0, threads = 1;
+        Stats stats;
+        double flops = 0;  // floating point operations of one call, 0 when not meaningful
+        double bytes = 0;  // bytes moved by one call (compulsory traffic), 0 when not meaningful
+        std::vector<algebra::perf::RegionStats> regions;  // hardware counters, empty unless PERF=1
+
+        // rates at the median time
+        double gflops() const { return flops > 0 && stats.median > 0 ? flops / stats.median * 1e-3 : 0; }
+        double gbytes() const { return bytes > 0 && stats.median > 0 ? bytes / stats.median * 1e-3 : 0; }
+    };
+
+    inline void print(std::ostream& os, const Record& r) {
+        os << std::left << std::setw(22) << r.operation << std::right << std::fixed << std::setprecision(2)
+           << " median " << std::setw(10) << r.stats.median << " us   p10 " << std::setw(10) << r.stats.p10
+           << " us   p90 " << std::setw(10) << r.stats.p90 << " us";
+        if (r.flops > 0)
+            os << "   " << std::setw(7) << r.gflops() << " GFLOP/s";
+        if (r.bytes > 0)
+            os << "   " << std::setw(7) << r.gbytes() << " GB/s";
+        os << std::defaultfloat << "\n";
+
+        // per call averages of the regions
+        using namespace algebra::perf;
+        for (const auto& region : r.regions) {
+            const double calls = static_cast<double>(region.calls);
+            os << "    " << std::left << std::setw(18) << (region.name + "[" + std::to_string(region.thread) + "]")
+               << std::right << std::fixed << std::setprecision(2) << " calls " << std::setw(5) << region.calls
+               << "   wall " << std::setw(10) << region.wall_time / calls << " us";
+            if (region.counted[CYCLES] && region.counted[INSTRUCTIONS] && region.counts[CYCLES] > 0)
+                os << "   IPC " << std::setw(5) << double(region.counts[INSTRUCTIONS]) / region.counts[CYCLES];
+            for (std::size_t e = 0; e < NUM_EVENTS; ++e)
+                if (region.counted[e])
+                    os << "   " << event_names[e] << " " << std::setprecision(0) << region.counts[e] / calls;
+            os << std::defaultfloat << "\n";
+        }
+    }
+
+    inline void write_csv(const std::string& file_name, const std::vector<Record>& records) {
+        std::ofstream file(file_name);
+        if (!file.is_open())
+            throw std::runtime_error("Failed to open file: " + file_name);
+        file << "matrix,type,order,operation,rows,cols,nnz,threads,runs,"
+                "min_us,p10_us,median_us,p90_us,max_us,mean_us,gflops,gbytes_per_s\n";
+        file << std::setprecision(6);
+        for (const auto& r : records) {
+            file << r.matrix << ',' << r.type << ',' << r.order << ',' << r.operation << ',' << r.rows << ','
+                 << r.cols << ',' << r.nnz << ',' << r.threads << ',' << r.stats.runs << ',' << r.stats.min << ','
+                 << r.stats.p10 << ',' << r.stats.median << ',' << r.stats.p90 << ',' << r.stats.max << ','
+                 << r.stats.mean << ',' << r.gflops() << ',' << r.gbytes() << '\n';
+        }
+    }
+
+    inline void write_json(const std::string& file_name, const std::vector<Record>& records) {
+        std::ofstream file(file_name);
+        if (!file.is_open())
+            throw std::runtime_error("Failed to open file: " + file_name);
+        auto quoted = [](const std::string& s) {
+            std::string out = "\"";
+            for (char c : s) {
+                if (c == '"' || c == '\\')
+                    out += '\\';
+                out += c;
+            }
+            return out + "\"";
+        };
+        file << std::setprecision(6) << "[\n";
+        for (std::size_t k = 0; k < records.size(); ++k) {
+            const auto& r = records[k];
+            file << "  {\"matrix\": " << quoted(r.matrix) << ", \"type\": " << quoted(r.type)
+                 << ", \"order\": " << quoted(r.order) << ", \"operation\": " << quoted(r.operation)
+                 << ", \"rows\": " << r.rows << ", \"cols\": " << r.cols << ", \"nnz\": " << r.nnz
+                 << ", \"threads\": " << r.threads << ", \"runs\": " << r.stats.runs
+                 << ", \"min_us\": " << r.stats.min << ", \"p10_us\": " << r.stats.p10
+                 << ", \"median_us\": " << r.stats.median << ", \"p90_us\": " << r.stats.p90
+                 << ", \"max_us\": " << r.stats.max << ", \"mean_us\": " << r.stats.mean
+                 << ", \"gflops\": " << r.gflops() << ", \"gbytes_per_s\": " << r.gbytes();
+            if (!r.regions.empty()) {
+                file << ", \"regions\": [";
+                for (std::size_t p = 0; p < r.regions.size(); ++p) {
+                    const auto& region = r.regions[p];
+                    file << (p == 0 ? "" : ", ") << "{\"name\": " << quoted(region.name)
+                         << ", \"thread\": " << region.thread << ", \"calls\": " << region.calls
+                         << ", \"wall_us\": " << region.wall_time;
+                    for (std::size_t e = 0; e < algebra::perf::NUM_EVENTS; ++e)
+                        if (region.counted[e])
+                            file << ", \"" << algebra::perf::event_names[e] << "\": " << region.counts[e];
+                    file << "}";
+                }
+                file << "]";
+            }
+            file << "}" << (k + 1 < records.size() ? ",\n" : "\n");
+        }
+        file << "]\n";
+    }
+
+    //! one line per record, region and thread; events that could not be counted are left empty
+    inline void write_counters_csv(const std::string& file_name, const std::vector<Record>& records) {
+        std::ofstream file(file_name);
+        if (!file.is_open())
+            throw std::runtime_error("Failed to open file: " + file_name);
+        file << "matrix,type,order,operation,region,thread,calls,wall_us";
+        for (const char* event : algebra::perf::event_names)
+            file << ',' << event;
+        file << '\n' << std::setprecision(6);
+        for (const auto& r : records) {
+            for (const auto& region : r.regions) {
+                file << r.matrix << ',' << r.type << ',' << r.order << ',' << r.operation << ',' << region.name << ','
+                     << region.thread << ',' << region.calls << ',' << region.wall_time;
+                for (std::size_t e = 0; e < algebra::perf::NUM_EVENTS; ++e) {
+                    file << ',';
+                    if (region.counted[e])
+                        file << region.counts[e];
+                }
+                file << '\n';
+            }
+        }
+    }
+
+}  // namespace bench
+
+#endif
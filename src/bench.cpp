@@ -0,0 +1,223 @@
+#include <complex>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Benchmark.hpp"
+#include "Matrix.hpp"
+#include "MatrixFileConstructor.hpp"
+#include "MixedMatrix.hpp"
+#include "Utils.hpp"
+
+using namespace algebra;
+
+// Benchmark of the Matrix class: every matrix file is read as double, float
+// and std::complex<double>, in both StorageOrders, and every operation is
+// timed --runs times after --warmup untimed calls.
+//
+// With PERF=1 the hardware counters of every region (PerfCounters.hpp) are
+// printed under the operation and written by --counters-csv and --json.
+//
+// usage: ./bench [--runs N] [--warmup N] [--threads N] [--csv file] [--json file]
+//                [--counters-csv file] [matrix.mtx ...]
+
+struct Options {
+  int num_runs = 20;
+  int num_warmup = 2;
+  std::size_t num_threads = 1;
+  std::string csv_file, json_file, counters_file;
+  std::vector<std::string> files;
+};
+
+template <Numeric T>
+std::string type_name() {
+  if constexpr (std::is_same_v<T, double>) return "double";
+  else if constexpr (std::is_same_v<T, float>) return "float";
+  else if constexpr (std::is_same_v<T, std::complex<double>>) return "complex<double>";
+  else return "other";
+}
+
+// flops of one multiply-add and of one term of the norms (abs and sqrt not counted)
+template <Numeric T>
+constexpr double flops_fma = is_complex_v<T> ? 8 : 2;
+template <Numeric T>
+constexpr double flops_norm2 = is_complex_v<T> ? 4 : 2;
+template <Numeric T>
+constexpr double flops_abs_sum = is_complex_v<T> ? 4 : 1;
+
+template <Numeric T, StorageOrder order>
+void bench_matrix(const std::string& file_name, const Options& options, std::vector<bench::Record>& records) {
+  using Index = std::size_t;
+  const std::string order_name = order == ROW_MAJOR ? "ROW_MAJOR" : "COL_MAJOR";
+  std::cout << file_name << "  " << type_name<T>() << "  " << order_name << "\n";
+
+  Matrix<T, order> reference(file_name, true);
+  const std::size_t rows = reference.get_rows(), cols = reference.get_cols(), nnz = reference.get_num_non_zero();
+  const std::size_t n_outer = order == ROW_MAJOR ? rows : cols;
+  auto record = [&](const std::string& operation, const bench::Stats& stats, double flops, double bytes) {
+    bench::Record r{file_name, type_name<T>(), order_name, operation, rows, cols, nnz, options.num_threads, stats, flops, bytes,
+                    perf::snapshot()};
+    bench::print(std::cout, r);
+    records.push_back(r);
+  };
+
+  // triplets of the matrix, in the order of the compressed arrays
+  const auto& ptr = order == ROW_MAJOR ? reference.get_row_indices() : reference.get_col_indices();
+  const auto& idx = order == ROW_MAJOR ? reference.get_col_indices() : reference.get_row_indices();
+  const auto& val = reference.get_values();
+  std::vector<std::size_t> entry_rows(nnz), entry_cols(nnz);
+  for (std::size_t i = 0; i < n_outer; ++i) {
+    for (std::size_t k = ptr[i]; k < ptr[i + 1]; ++k) {
+      entry_rows[k] = order == ROW_MAJOR ? i : idx[k];
+      entry_cols[k] = order == ROW_MAJOR ? idx[k] : i;
+    }
+  }
+
+  // bytes of the compressed arrays, and of x and y for the products
+  const double array_bytes = nnz * (sizeof(T) + sizeof(Index)) + (n_outer + 1) * sizeof(Index);
+  const double vector_bytes = (cols + (order == ROW_MAJOR ? 1 : 2) * rows) * sizeof(T);
+
+  record("read", bench::measure(options.num_warmup, options.num_runs, [&] {
+    Matrix<T, order> m(file_name);
+    bench::keep(m);
+  }), 0, 0);
+
+  Matrix<T, order> m;
+  record("assembly_map", bench::measure(options.num_warmup, options.num_runs,
+    [&] { m = Matrix<T, order>(rows, cols); },
+    [&] {
+      for (std::size_t k = 0; k < nnz; ++k)
+        m(entry_rows[k], entry_cols[k]) = val[k];
+    }), 0, 0);
+
+  PooledMatrix<T, order> pooled;
+  record("assembly_pool", bench::measure(options.num_warmup, options.num_runs,
+    [&] { pooled = PooledMatrix<T, order>(rows, cols); },
+    [&] {
+      for (std::size_t k = 0; k < nnz; ++k)
+        pooled(entry_rows[k], entry_cols[k]) = val[k];
+    }), 0, 0);
+
+  record("assembly_triplet", bench::measure(options.num_warmup, options.num_runs,
+    [&] {
+      m = Matrix<T, order>(rows, cols);
+      m.set_assembly(TRIPLET_ASSEMBLY);
+    },
+    [&] {
+      m.reserve(nnz);
+      for (std::size_t k = 0; k < nnz; ++k)
+        m.add(entry_rows[k], entry_cols[k], val[k]);
+    }), 0, 0);
+
+  // compress() runs on --threads threads
+  Matrix<T, order> uncompressed(file_name);
+  uncompressed.set_num_threads(options.num_threads);
+  record("compress", bench::measure(options.num_warmup, options.num_runs,
+    [&] { m = uncompressed; },
+    [&] { m.compress(); }), 0, array_bytes);
+
+  record("uncompress", bench::measure(options.num_warmup, options.num_runs,
+    [&] { m = reference; },
+    [&] { m.uncompress(); }), 0, array_bytes);
+
+  m = reference;
+  m.set_num_threads(options.num_threads);
+  const std::vector<T> x = vector_generator<T>(cols);
+  std::vector<T> y(rows);
+  record("spmv", bench::measure(options.num_warmup, options.num_runs, [&] {
+    m.multiply(x, y);
+    bench::keep(y);
+  }), flops_fma<T> * nnz, array_bytes + vector_bytes);
+
+  // the same with the values stored in single precision (CSR), accumulated in T
+  if constexpr (std::is_same_v<T, double> || std::is_same_v<T, std::complex<double>>) {
+    using Narrow = std::conditional_t<is_complex_v<T>, std::complex<float>, float>;
+    MixedMatrix<Narrow, T> mixed(reference);
+    mixed.set_num_threads(options.num_threads);
+    const double mixed_bytes = nnz * (sizeof(Narrow) + sizeof(Index)) + (rows + 1) * sizeof(Index) + (cols + rows) * sizeof(T);
+    record("spmv_mixed", bench::measure(options.num_warmup, options.num_runs, [&] {
+      mixed.multiply(x, y);
+      bench::keep(y);
+    }), flops_fma<T> * nnz, mixed_bytes);
+  }
+
+  record("norm_frobenius", bench::measure(options.num_warmup, options.num_runs, [&] {
+    bench::keep(m.template norm<WhichNorm::FROBENIUS>());
+  }), flops_norm2<T> * nnz, nnz * sizeof(T));
+  record("norm_one", bench::measure(options.num_warmup, options.num_runs, [&] {
+    bench::keep(m.template norm<WhichNorm::ONE>());
+  }), flops_abs_sum<T> * nnz, array_bytes);
+  record("norm_max", bench::measure(options.num_warmup, options.num_runs, [&] {
+    bench::keep(m.template norm<WhichNorm::MAX>());
+  }), flops_abs_sum<T> * nnz, array_bytes);
+
+  // the same on the map
+  const Matrix<T, order>& map = uncompressed;
+  record("spmv_map", bench::measure(options.num_warmup, options.num_runs, [&] {
+    bench::keep(map * x);
+  }), flops_fma<T> * nnz, 0);
+  record("norm_frobenius_map", bench::measure(options.num_warmup, options.num_runs, [&] {
+    bench::keep(map.template norm<WhichNorm::FROBENIUS>());
+  }), flops_norm2<T> * nnz, 0);
+  record("norm_one_map", bench::measure(options.num_warmup, options.num_runs, [&] {
+    bench::keep(map.template norm<WhichNorm::ONE>());
+  }), flops_abs_sum<T> * nnz, 0);
+  record("norm_max_map", bench::measure(options.num_warmup, options.num_runs, [&] {
+    bench::keep(map.template norm<WhichNorm::MAX>());
+  }), flops_abs_sum<T> * nnz, 0);
+  std::cout << "\n";
+}
+
+template <Numeric T>
+void bench_type(const std::string& file_name, const Options& options, std::vector<bench::Record>& records) {
+  bench_matrix<T, ROW_MAJOR>(file_name, options, records);
+  bench_matrix<T, COL_MAJOR>(file_name, options, records);
+}
+
+int main(int argc, char* argv[]) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc) {
+        std::cerr << "Error: " << arg << " option requires an argument" << std::endl;
+        std::exit(1);
+      }
+      return argv[++i];
+    };
+    if (arg == "--runs") {
+      options.num_runs = std::stoi(value());
+    } else if (arg == "--warmup") {
+      options.num_warmup = std::stoi(value());
+    } else if (arg == "--threads") {
+      options.num_threads = std::stoul(value());
+      if (options.num_threads == 0)
+        options.num_threads = parallel::hardware_threads();
+    } else if (arg == "--csv") {
+      options.csv_file = value();
+    } else if (arg == "--json") {
+      options.json_file = value();
+    } else if (arg == "--counters-csv") {
+      options.counters_file = value();
+    } else {
+      options.files.push_back(arg);
+    }
+  }
+  if (options.files.empty())
+    options.files = {"./lnsp_131.mtx", "./small_example.mtx"};
+
+  std::vector<bench::Record> records;
+  for (const auto& file_name : options.files) {
+    bench_type<double>(file_name, options, records);
+    bench_type<float>(file_name, options, records);
+    bench_type<std::complex<double>>(file_name, options, records);
+  }
+
+  if (!options.csv_file.empty())
+    bench::write_csv(options.csv_file, records);
+  if (!options.json_file.empty())
+    bench::write_json(options.json_file, records);
+  if (!options.counters_file.empty())
+    bench::write_counters_csv(options.counters_file, records);
+  return 0;
+}
@@ -8,8 +8,16 @@
 
 using namespace algebra;
 
+// value type and storage order of the tests, e.g. make CPPFLAGS+="-DTYPE=float -DORDER=COL_MAJOR"
+#ifndef TYPE
+#define TYPE std::complex<double>
+#endif
+#ifndef ORDER
+#define ORDER ROW_MAJOR
+#endif
+
 int main(int argc, char* argv[]) {
-  using type_chosen = std::complex<double>;
+  using type_chosen = TYPE;
   std::string big_file_name = "./lnsp_131.mtx";
   std::string small_file_name = "./small_example.mtx";
 
@@ -38,7 +46,7 @@ int main(int argc, char* argv[]) {
   }
 
   //choose the type of the matrix here:
-  MatrixTest<type_chosen, StorageOrder::ROW_MAJOR> tester(verbose, num_runs); // 0 for no print of the whole matrices
+  MatrixTest<type_chosen, StorageOrder::ORDER> tester(verbose, num_runs); // 0 for no print of the whole matrices
 
   // Test the reader - initialize tester matrix member
   tester.ReadMatrices(big_file_name, 1);  // file_matrix_name, which matrix to read 
@@ -46,16 +54,90 @@ int main(int argc, char* argv[]) {
   // Test if compression and uncompression work
   tester.testCompressionUncompression();
 
+  // Test the chunked Matrix Market parse against the serial one
+  tester.testMarketReader(big_file_name);
+
 
   // // Test the const and non-const call operator
   tester.testCallOperator(1,3,10); // 1,3 is not present in the matrix
   tester.ReadMatrices(big_file_name, 1); //reset the matrix to previous state
 
   // // Test the matrix-vector multiplication
-  tester.testVectorMultiplication();  //note: in the previous test we changed the dimension of the matrix
+  tester.testVectorMultiplication(num_runs);  //note: in the previous test we changed the dimension of the matrix
+
+  // Test the parallel compressed matrix-vector multiplication
+  tester.testParallelMultiplication(4, num_runs);
+
+  // Test the allocation-free y = alpha A x + beta y
+  tester.testInPlaceMultiplication(num_runs);
+
+  // Test the transpose and conjugate transpose multiplication
+  tester.testTransposeMultiplication(4);
+
+  // Test the conversion between storage orders
+  tester.testOrderConversion(big_file_name, 4, num_runs);
+
+  // Test the multi-vector (block) multiplication
+  tester.testBlockMultiplication(8, num_runs);
+
+  // Test the binary format (written next to the matrix files)
+  tester.testBinaryIO(big_file_name, "./lnsp_131.bin", num_runs);
+
+  // Test the triplet assembly back end
+  tester.testTripletAssembly(num_runs);
+
+  // Test the 32-bit index type
+  tester.testIndexWidth(big_file_name, "./lnsp_131_32.bin", num_runs);
+
+  // Test the block compressed (BSR) storage
+  tester.testBlockStorage(num_runs);
+
+  // Test the SELL-C-sigma storage and its SIMD kernels
+  tester.testSellStorage(4, num_runs);
+
+  // Test the Krylov solvers
+  tester.testSolvers(num_runs);
+
+  // Test the preconditioners
+  tester.testPreconditioners(2, num_runs);
+
+  // Test the symmetric / hermitian storage
+  tester.testSymmetricStorage(2, num_runs);
+
+  // Test the RCM reordering
+  tester.testReordering(num_runs);
+
+  // Test the hardware counter regions (recorded only with make PERF=1)
+  tester.testPerfCounters(2);
+
+  // Test the pool allocator of the map nodes
+  tester.testPoolAllocator(num_runs);
+
+  // Test the multithreaded compression
+  tester.testParallelCompression(4, num_runs);
+
+  // Test the element lookup on the compressed arrays
+  tester.testCompressedLookup(num_runs);
+
+  // Test the writes into a compressed matrix (pending buffer)
+  tester.testPendingInserts(4, num_runs);
+
+  // Test the single precision storage with accumulation in T
+  tester.testMixedPrecision(4, num_runs);
+
+  // Test the product streamed from row panels on disk
+  tester.testOutOfCore(big_file_name, "./lnsp_131.panels", 4, num_runs);
+
+  // Test the batch of matrices sharing one pattern
+  tester.testBatchedMatrix(4, num_runs);
 
   // Test the norm
-  tester.testNorm<WhichNorm::FROBENIUS>();
+  tester.testNorm<WhichNorm::FROBENIUS>(num_runs);
+
+  // Test the matrix-matrix multiplication (A * A)
+  tester.ReadMatrices(big_file_name, 1);
+  tester.ReadMatrices(big_file_name, 2);
+  tester.testMatrixMultiplication(big_file_name, num_runs);
 
   return 0;
 }